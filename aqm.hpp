@@ -0,0 +1,82 @@
+#ifndef AQM_HPP
+#define AQM_HPP
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+
+struct codel_options {
+    // acceptable standing sojourn time, zero disables queue management
+    std::chrono::nanoseconds target{0};
+    // window over which the minimum sojourn time must stay above target
+    std::chrono::nanoseconds interval{std::chrono::milliseconds(100)};
+    // deliver and mark messages instead of dropping them
+    bool mark = false;
+};
+
+// Controlled Delay (RFC 8289) queue management, evaluated per dequeued
+// message by the single consumer.
+class codel {
+    public:
+        typedef std::chrono::steady_clock clock;
+        enum class verdict { pass, drop, mark };
+
+    private:
+        codel_options options;
+        clock::time_point first_above{};
+        clock::time_point drop_next{};
+        uint32_t count = 0;
+        uint32_t last_count = 0;
+        bool dropping = false;
+
+        clock::time_point control_law(clock::time_point t) const {
+            return t + std::chrono::duration_cast<clock::duration>(
+                options.interval / std::sqrt(double(count)));
+        }
+        bool ok_to_drop(clock::time_point enqueued, clock::time_point now, bool queue_empty);
+
+    public:
+        codel(codel_options options = {}) : options(options) {}
+
+        bool enabled() const { return options.target.count() != 0; }
+        bool in_drop_state() const { return dropping; }
+        verdict on_dequeue(clock::time_point enqueued, clock::time_point now, bool queue_empty);
+};
+
+inline bool codel::ok_to_drop(clock::time_point enqueued, clock::time_point now, bool queue_empty) {
+    if (now - enqueued < options.target || queue_empty) {
+        first_above = clock::time_point{};
+        return false;
+    }
+    if (first_above == clock::time_point{}) {
+        first_above = now + options.interval;
+        return false;
+    }
+    return now >= first_above;
+}
+
+inline codel::verdict codel::on_dequeue(clock::time_point enqueued, clock::time_point now, bool queue_empty) {
+    verdict action = options.mark ? verdict::mark : verdict::drop;
+    bool ok = ok_to_drop(enqueued, now, queue_empty);
+    if (dropping) {
+        if (!ok) {
+            dropping = false;
+            return verdict::pass;
+        }
+        if (now < drop_next)
+            return verdict::pass;
+        ++count;
+        drop_next = control_law(drop_next);
+        return action;
+    }
+    if (!ok)
+        return verdict::pass;
+    dropping = true;
+    uint32_t delta = count - last_count;
+    count = (delta > 1 && now - drop_next < 16 * options.interval) ? delta : 1;
+    drop_next = control_law(now);
+    last_count = count;
+    return action;
+}
+
+#endif
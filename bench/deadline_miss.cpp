@@ -0,0 +1,110 @@
+// Deadline-miss rate of a FIFO channel against the earliest-deadline-first
+// channel under increasing load.
+//
+//   g++ -std=c++17 -O2 -pthread -I.. deadline_miss.cpp -o deadline_miss
+//
+// Producers send tasks with a mix of tight and loose relative deadlines; the
+// consumer spins for a fixed service time per task and records a miss when
+// it finishes a task after its deadline.
+
+#include "../channel.hpp"
+#include "../deadline_channel.hpp"
+
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <vector>
+
+using std::chrono::steady_clock;
+using std::chrono::microseconds;
+
+struct task {
+    steady_clock::time_point deadline;
+};
+
+struct result {
+    size_t done = 0;
+    size_t missed = 0;
+};
+
+static const int producers = 4;
+static const int tasks_per_producer = 2000;
+static const microseconds service{50};
+
+static void spin(microseconds d) {
+    auto until = steady_clock::now() + d;
+    while (steady_clock::now() < until) {}
+}
+
+static microseconds relative_deadline(std::mt19937& rng) {
+    // one task in five is urgent
+    return rng() % 5 == 0 ? microseconds(1000) : microseconds(20000);
+}
+
+template <typename Send>
+static void produce(int id, double load, Send send) {
+    std::mt19937 rng(id);
+    auto gap = microseconds(int(service.count() * producers / load));
+    auto next = steady_clock::now();
+    for (int i = 0; i < tasks_per_producer; ++i) {
+        std::this_thread::sleep_until(next);
+        next += gap;
+        send(task{steady_clock::now() + relative_deadline(rng)});
+    }
+}
+
+template <typename Recv>
+static result consume(Recv recv) {
+    result r;
+    while (std::optional<task> t = recv()) {
+        spin(service);
+        ++r.done;
+        if (steady_clock::now() > t->deadline)
+            ++r.missed;
+    }
+    return r;
+}
+
+static result run_fifo(double load) {
+    auto [sender, receiver] = make_channel<task>();
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p)
+        threads.emplace_back([p, load, tx = sender]() mutable {
+            produce(p, load, [&](task t) { tx.send(std::move(t)); });
+        });
+    std::thread closer([&] {
+        for (std::thread& t : threads)
+            t.join();
+        sender.close();
+    });
+    result r = consume([&] { return receiver.recv(); });
+    closer.join();
+    return r;
+}
+
+static result run_edf(double load) {
+    auto [sender, receiver] = make_deadline_channel<task>();
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p)
+        threads.emplace_back([p, load, tx = sender]() mutable {
+            produce(p, load, [&](task t) { tx.send(t, t.deadline); });
+        });
+    std::thread closer([&] {
+        for (std::thread& t : threads)
+            t.join();
+        sender.close();
+    });
+    result r = consume([&] { return receiver.recv(); });
+    closer.join();
+    return r;
+}
+
+int main() {
+    std::printf("%-6s %12s %12s\n", "load", "fifo miss%", "edf miss%");
+    for (double load : {0.5, 0.9, 1.1, 1.5}) {
+        result fifo = run_fifo(load);
+        result edf = run_edf(load);
+        std::printf("%-6.2f %11.2f%% %11.2f%%\n", load,
+                    100.0 * fifo.missed / fifo.done, 100.0 * edf.missed / edf.done);
+    }
+}
@@ -0,0 +1,117 @@
+#ifndef BUDGET_HPP
+#define BUDGET_HPP
+
+#include "stop.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+
+template <typename T, typename = void>
+struct has_size_of : std::false_type {};
+
+template <typename T>
+struct has_size_of<T, std::void_t<decltype(size_of(std::declval<const T&>()))>> : std::true_type {};
+
+// Bytes accounted for one queued message. A `size_t size_of(const T&)` found
+// by argument-dependent lookup is used when present, sizeof(T) otherwise;
+// types in foreign namespaces can specialize message_size instead.
+template <typename T>
+struct message_size {
+    size_t operator()(const T& val) const {
+        if constexpr (has_size_of<T>::value)
+            return size_of(val);
+        else
+            return sizeof(T);
+    }
+};
+
+enum class budget_policy {
+    // senders wait until consumers release enough bytes
+    block,
+    // messages that do not fit are discarded and counted
+    drop
+};
+
+// Process-wide byte limit shared by any number of channels.
+class MemoryBudget {
+    private:
+        const size_t _limit;
+        const budget_policy _policy;
+        std::atomic<size_t> _used{0};
+        std::atomic<size_t> waiters{0};
+        std::atomic<uint64_t> _dropped{0};
+        std::atomic<uint64_t> _blocked{0};
+        std::mutex mutex;
+        std::condition_variable released;
+
+    public:
+        MemoryBudget(size_t limit, budget_policy policy = budget_policy::block)
+            : _limit(limit), _policy(policy) {}
+        MemoryBudget(const MemoryBudget&) = delete;
+        MemoryBudget& operator=(const MemoryBudget&) = delete;
+
+        // Charges bytes without waiting. A message larger than the whole
+        // budget is admitted when nothing else is in flight.
+        bool try_acquire(size_t bytes);
+        // Charges bytes according to the policy; false means the message
+        // must be dropped, or that stop was requested while waiting.
+        template <typename Stop = never_stop>
+        bool acquire(size_t bytes, const Stop& stop = Stop());
+        void release(size_t bytes);
+        // makes blocked acquires re-check their stop condition
+        void wake();
+
+        size_t limit() const { return _limit; }
+        size_t used() const { return _used.load(std::memory_order_relaxed); }
+        budget_policy policy() const { return _policy; }
+        uint64_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+        uint64_t blocked() const { return _blocked.load(std::memory_order_relaxed); }
+};
+
+inline bool MemoryBudget::try_acquire(size_t bytes) {
+    size_t current = _used.load(std::memory_order_seq_cst);
+    do {
+        if (current + bytes > _limit && current != 0)
+            return false;
+    } while (!_used.compare_exchange_weak(current, current + bytes, std::memory_order_acq_rel));
+    return true;
+}
+
+template <typename Stop>
+bool MemoryBudget::acquire(size_t bytes, const Stop& stop) {
+    if (try_acquire(bytes))
+        return true;
+    if (_policy == budget_policy::drop) {
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    _blocked.fetch_add(1, std::memory_order_relaxed);
+    [[maybe_unused]] auto wake = wake_on_stop(stop, [this]{
+        { std::lock_guard<std::mutex> lock(mutex); }
+        released.notify_all();
+    });
+    std::unique_lock<std::mutex> lock(mutex);
+    waiters.fetch_add(1, std::memory_order_seq_cst);
+    bool acquired = false;
+    released.wait(lock, [&]{ return (acquired = try_acquire(bytes)) || stop.stop_requested(); });
+    waiters.fetch_sub(1, std::memory_order_relaxed);
+    return acquired;
+}
+
+inline void MemoryBudget::wake() {
+    { std::lock_guard<std::mutex> lock(mutex); }
+    released.notify_all();
+}
+
+inline void MemoryBudget::release(size_t bytes) {
+    _used.fetch_sub(bytes, std::memory_order_seq_cst);
+    if (waiters.load(std::memory_order_seq_cst) == 0)
+        return;
+    { std::lock_guard<std::mutex> lock(mutex); }
+    released.notify_all();
+}
+
+#endif
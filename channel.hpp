@@ -2,36 +2,379 @@
 #define CHANNEL_HPP
 
 #include "queue.hpp"
+#include "memory.hpp"
+#include "budget.hpp"
+#include "aqm.hpp"
+#include "registry.hpp"
+#include "tracing.hpp"
+#include "reclaimer.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <deque>
 #include <tuple>
 #include <optional>
 #include <type_traits>
 #include <stdexcept>
+#include <string>
+#include <vector>
 
 template <typename T> class Sender;
 template <typename T> class Receiver;
 
+template <typename T>
+struct shutdown_report {
+    // messages the consumer dequeued between shutdown and the deadline
+    uint64_t drained = 0;
+    // messages still queued at the deadline, in send order per producer
+    std::vector<T> returned;
+};
+
+struct trim_policy {
+    // trim the arena once depth has stayed at or below low_depth for
+    // idle_period; a zero idle_period disables automatic trimming
+    size_t low_depth = 0;
+    std::chrono::milliseconds idle_period{0};
+};
+
+struct channel_options {
+    // serve queue nodes and payload blocks from a per-channel arena
+    bool arena = false;
+    // arena region settings; huge_pages implies arena
+    arena_options memory;
+    trim_policy trim;
+    // shared byte limit charged with message_size<T> for every queued message
+    std::shared_ptr<MemoryBudget> budget;
+    // account bytes in flight with message_size<T>; implied by max_bytes and budget
+    bool track_bytes = false;
+    // per-channel byte capacity, senders block while it is exhausted; 0 is unbounded
+    size_t max_bytes = 0;
+    // maximum queued messages, 0 is unbounded
+    size_t capacity = 0;
+    // what send does when capacity is reached
+    overflow_policy overflow = overflow_policy::block;
+    // CoDel management of the sojourn time, off unless a target is set
+    codel_options aqm;
+    // deadline given to messages sent without one, zero means none
+    std::chrono::nanoseconds ttl{0};
+    // unconsumed messages each sender may have queued, 0 is unlimited
+    size_t credits = 0;
+    // give every sender its own sub-queue and serve them by deficit
+    // round-robin, Sender::set_weight messages per round; capacity and
+    // overflow then apply to each sub-queue
+    bool fair = false;
+    // shown by ChannelRegistry when it is enabled
+    std::string name;
+    // record how long each delivered message waited in the queue
+    bool latency_histogram = false;
+    // per-Sender messages, bytes, time blocked and time in send, reported
+    // in stats().producers
+    bool producer_accounting = false;
+    // time constant of the arrival and service rate averages, zero disables
+    // them
+    std::chrono::nanoseconds rate_window{0};
+    // start a trace on one in this many messages sent outside any trace, 0
+    // for none; messages sent while handling a traced one always continue
+    // its trace
+    size_t trace_every = 0;
+    // hand dropped messages, values given to Receiver::retire and the
+    // envelopes of received messages to the background reclaimer in batches
+    // of this many; a received value itself goes to the caller, so retire it
+    // to defer its destructor too. 0 destroys them on the consumer thread
+    size_t reclaim_batch = 0;
+    // depth at or above which the channel reports congestion, 0 disables
+    size_t high_watermark = 0;
+    // depth at or below which congestion clears again; must be below
+    // high_watermark
+    size_t low_watermark = 0;
+    // called with the new state on every crossing, from the thread that
+    // crossed; must not block
+    std::function<void(bool congested)> on_watermark;
+};
+
+template <typename T>
+std::tuple<Sender<T>, Receiver<T>> make_channel(const channel_options& options);
+
 template <typename T>
 std::tuple<Sender<T>, Receiver<T>> make_channel();
 
 template <typename T>
 class Channel {
     private:
-        Channel() {};
-        threadsafe_queue<T> que;
-        bool _closed = false;
+        Channel(const channel_options& options)
+            : pool(options.arena || options.memory.huge_pages
+                   ? new arena_resource(options.memory) : nullptr),
+              que(pool ? pool.get() : std::pmr::new_delete_resource()),
+              budget(options.budget),
+              byte_limit(options.max_bytes ? new MemoryBudget(options.max_bytes) : nullptr),
+              track_bytes(options.track_bytes || options.max_bytes || options.budget),
+              capacity(options.capacity), overflow(options.overflow),
+              stamping(options.aqm.target.count() != 0 || options.latency_histogram),
+              tracking_latency(options.latency_histogram),
+              accounting(options.producer_accounting), rate_window(options.rate_window),
+              trace_every(options.trace_every), name(options.name),
+              reclaim_batch(options.reclaim_batch), ttl(options.ttl),
+              credits(options.credits), fair(options.fair), pinning(credits || fair),
+              high_watermark(options.high_watermark), low_watermark(options.low_watermark),
+              on_watermark(options.on_watermark),
+              trim(options.trim), aqm(options.aqm) {
+            if (high_watermark && low_watermark >= high_watermark)
+                throw std::logic_error("Channel low_watermark must be below high_watermark.");
+            if (trace_every)
+                tracing::enabled.store(true, std::memory_order_relaxed);
+        };
+
+        typedef std::chrono::steady_clock clock;
+
+        struct message;
+
+        // per-Sender state; queued messages point back at it, so when pinning
+        // it is freed only once its Sender is gone and none of its messages
+        // are queued
+        struct producer {
+            // one for the Sender, one for each queued message when pinning
+            std::atomic<size_t> refs{1};
+            // position in producers
+            size_t slot = 0;
+            std::atomic<size_t> outstanding{0};
+            // threads of this Sender blocked on credits, changed under mutex
+            std::atomic<size_t> credit_waiters{0};
+            std::mutex mutex;
+            std::condition_variable credit_cond;
+            std::atomic<uint32_t> weight{1};
+            // fair mode only: the sub-queue and its consumer-side deficit
+            std::unique_ptr<threadsafe_queue<message>> lane;
+            size_t deficit = 0;
+            // registration order, reported as the producer id
+            uint64_t id = 0;
+            // sends so far; every trace_every-th starts a trace
+            std::atomic<uint64_t> sends{0};
+            // written by the sending threads, on its own cache line
+            struct alignas(64) {
+                std::atomic<uint64_t> messages{0};
+                std::atomic<uint64_t> bytes{0};
+                std::atomic<uint64_t> blocked_ns{0};
+                std::atomic<uint64_t> send_ns{0};
+            } usage;
+        };
+
+        // adds the time spent in one send to its producer when accounting
+        struct send_clock {
+            producer* origin;
+            clock::time_point started;
+            send_clock(const Channel& ch, producer* p)
+                : origin(ch.accounting ? p : nullptr), started(origin ? clock::now() : clock::time_point{}) {}
+            ~send_clock() {
+                if (origin)
+                    add(origin->usage.send_ns, uint64_t((clock::now() - started).count()));
+            }
+        };
+
+        // one Sender may be shared by several threads, so producer counters
+        // are read-modify-writes
+        static void add(std::atomic<uint64_t>& counter, uint64_t n) {
+            counter.fetch_add(n, std::memory_order_relaxed);
+        }
+
+        struct message {
+            T value;
+            clock::time_point enqueued;
+            clock::time_point deadline;
+            producer* origin;
+            // set on sampled messages only
+            std::unique_ptr<trace_context> trace;
+        };
+        static constexpr clock::time_point no_deadline = clock::time_point::max();
+
+        std::unique_ptr<arena_resource> pool;
+        threadsafe_queue<message> que;
+        std::atomic<bool> _closed{false};
+        std::shared_ptr<MemoryBudget> budget;
+        std::unique_ptr<MemoryBudget> byte_limit;
+        const bool track_bytes;
+        const size_t capacity;
+        const overflow_policy overflow;
+        // whether messages carry their enqueue time
+        const bool stamping;
+        const bool tracking_latency;
+        const bool accounting;
+        const std::chrono::nanoseconds rate_window;
+        const size_t trace_every;
+        const std::string name;
+        const size_t reclaim_batch;
+        const std::chrono::nanoseconds ttl;
+        const size_t credits;
+        const bool fair;
+        // whether queued messages keep their producer alive: releasing one
+        // touches it only to return a credit or, in fair mode, for its lane
+        const bool pinning;
+        const size_t high_watermark;
+        const size_t low_watermark;
+        const std::function<void(bool)> on_watermark;
+        std::atomic<bool> _congested{false};
+        std::atomic<uint64_t> high_crossings{0};
+
+        // shutdown: refuse sends, then wait for the consumer to empty the queue
+        std::atomic<bool> shutting_down{false};
+        std::atomic<uint64_t> rejected{0};
+        // flushing and shutting-down threads waiting for queued messages to
+        // leave, changed under dequeue_mutex; released() wakes them only
+        // when there are any
+        std::atomic<size_t> dequeue_waiters{0};
+        std::mutex dequeue_mutex;
+        std::condition_variable dequeue_cond;
+
+        std::mutex producers_mutex;
+        std::vector<std::unique_ptr<producer>> producers;
+        uint64_t next_producer_id = 0;
+        // bumped whenever producers changes
+        std::atomic<uint64_t> producers_epoch{0};
+        // fair mode: released producers, freed by the consumer once they are
+        // out of its rotation
+        std::vector<std::unique_ptr<producer>> retired;
 
-        friend std::tuple<Sender<T>, Receiver<T>> make_channel<T>();
+        // fair mode: messages across all lanes and the consumer's wake-up
+        std::atomic<size_t> fair_count{0};
+        std::atomic<bool> sleeping{false};
+        std::mutex wait_mutex;
+        std::condition_variable fair_cond;
+        // consumer-side round-robin position over a snapshot of producers
+        std::vector<producer*> rotation;
+        uint64_t rotation_epoch = 0;
+        size_t turn = 0;
+        bool in_turn = false;
+
+        // stats the consumer writes and those producers write sit on separate
+        // cache lines, so scraping and sending do not false-share
+        alignas(64) std::atomic<uint64_t> received{0};
+        std::atomic<uint64_t> aqm_dropped{0};
+        std::atomic<uint64_t> aqm_marked{0};
+        std::atomic<uint64_t> expired{0};
+        alignas(64) std::atomic<uint64_t> dropped{0};
+        // messages queued plus those dropped on arrival, counted only for
+        // the rate estimates; only ever grows
+        std::atomic<uint64_t> arrived{0};
+        std::atomic<size_t> bytes{0};
+        std::atomic<size_t> peak_bytes{0};
+        latency_histogram latency;
+
+        // rate estimates, published by the consumer as it dequeues, and the
+        // time of the last estimate
+        std::atomic<double> arrival_rate{0};
+        std::atomic<double> service_rate{0};
+        std::atomic<clock::rep> rates_published{0};
+        clock::time_point rates_sampled{};
+        uint64_t arrivals_seen = 0;
+        uint64_t served_seen = 0;
+
+        // consumer-side trim state
+        trim_policy trim;
+        std::optional<std::chrono::steady_clock::time_point> low_since;
+        bool trimmed = false;
+
+        // consumer-side queue management state
+        codel aqm;
+        bool last_marked = false;
+        std::function<void(T&&)> dead_letter;
+
+        // consumer-side batch waiting to be handed to the reclaimer
+        struct graveyard {
+            std::vector<std::shared_ptr<message>> messages;
+            std::vector<T> values;
+        };
+        graveyard dead;
+        bool reclaimed = false;
+
+        template <typename Stop>
+        std::shared_ptr<message> pop_waiting(clock::time_point deadline, const Stop& stop);
+        template <typename Stop = never_stop>
+        std::shared_ptr<message> pop_fair(bool wait, clock::time_point deadline = no_deadline,
+                                          const Stop& stop = Stop());
+        std::shared_ptr<message> next_fair();
+        void wake_fair_consumer();
+        size_t depth();
+        void queued(producer* origin, size_t size);
+        void arrival();
+        std::unique_ptr<trace_context> sample(producer* origin);
+        void add_blocked(producer* origin, clock::time_point since);
+        void check_high_watermark();
+        void check_low_watermark();
+        void on_dequeued();
+        void sample_rates();
+        bool refuse();
+        bool refused_after_wait();
+        void observe_depth();
+        bool screen(message& msg);
+        T deliver(message& msg);
+        template <typename Stop>
+        std::optional<T> next(clock::time_point deadline, const Stop& stop);
+        std::optional<T> try_next();
+        void bury(std::shared_ptr<message>&& msg);
+        void hand_off();
+        template <typename Stop = never_stop>
+        bool admit(producer* origin, const T& val, size_t& size, bool wait = true, const Stop& stop = Stop());
+        // false when the message was not queued
+        template <typename U, typename Stop = never_stop>
+        bool enqueue(producer* origin, U&& val, clock::time_point deadline, const Stop& stop = Stop());
+        template <typename U>
+        bool try_enqueue(producer* origin, U&& val, clock::time_point deadline);
+        void release_bytes(size_t size);
+        template <typename Stop = never_stop>
+        bool acquire_credit(producer* origin, const Stop& stop = Stop());
+        bool try_acquire_credit(producer* origin);
+        void return_credit(producer* origin);
+        void released(const message& msg);
+        void evicted(const message& old);
+        void consumed(const message& msg);
+
+        producer* add_producer();
+        void hold(producer* origin);
+        void drop(producer* origin);
+        size_t available_credits(producer* origin);
+        bool flush(producer* origin, clock::time_point deadline);
+        void set_weight(producer* origin, uint32_t weight);
+
+        friend class Sender<T>;
+        friend std::tuple<Sender<T>, Receiver<T>> make_channel<T>(const channel_options& options);
 
     public:
+    ~Channel();
 
-    void send(T&& val);
-    void send(const T& val);
+    void send(producer* origin, T&& val);
+    void send(producer* origin, const T& val);
+    void send_with_deadline(producer* origin, T&& val, clock::time_point deadline);
+    void send_with_deadline(producer* origin, const T& val, clock::time_point deadline);
+    bool try_send(producer* origin, T&& val);
+    bool try_send(producer* origin, const T& val);
+    template <typename U, typename Stop>
+    bool send(producer* origin, U&& val, const Stop& stop);
 
     void close_channel();
     bool closed();
+    shutdown_report<T> shutdown(clock::time_point deadline);
 
-    std::optional<T> recv();
+    // nullopt once closed and drained, at deadline, or once stop is requested
+    template <typename Stop = never_stop>
+    std::optional<T> recv(clock::time_point deadline = no_deadline, const Stop& stop = Stop());
     std::optional<T> try_recv();
+    template <typename Stop = never_stop>
+    size_t recv_batch(std::vector<T>& out, size_t max, const Stop& stop = Stop());
+    bool marked();
+    bool congested();
+    size_t size();
+    double time_to_drain();
+    void set_dead_letter(std::function<void(T&&)> handler);
+    void retire(T&& val);
+
+    channel_stats stats();
+    std::optional<arena_stats> memory_stats();
+    arena_stats prepare(size_t capacity, bool lock_pages);
+    size_t shrink_to_fit();
 
     Channel<T> &operator=(const Channel<T>&)=delete;
     Channel<T> &operator=(Channel<T>&&)=delete;
@@ -40,28 +383,869 @@ class Channel {
 };
 
 template <typename T>
-void Channel<T>::send(T&& val) {
-    que.push(std::move(val));
+Channel<T>::~Channel() {
+    // handed-off batches may still hold memory from this channel's pool
+    if (reclaimed)
+        Reclaimer::instance().drain();
+    if (!budget)
+        return;
+    while (std::shared_ptr<message> data = que.try_pop())
+        budget->release(message_size<T>{}(data->value));
+    for (auto& p : producers)
+        if (p->lane)
+            while (std::shared_ptr<message> data = p->lane->try_pop())
+                budget->release(message_size<T>{}(data->value));
+}
+
+template <typename T>
+void Channel<T>::send(producer* origin, T&& val) {
+    enqueue(origin, std::move(val), ttl.count() ? clock::now() + ttl : no_deadline);
+}
+
+template <typename T>
+void Channel<T>::send(producer* origin, const T& val) {
+    enqueue(origin, val, ttl.count() ? clock::now() + ttl : no_deadline);
+}
+
+template <typename T>
+void Channel<T>::send_with_deadline(producer* origin, T&& val, clock::time_point deadline) {
+    enqueue(origin, std::move(val), deadline);
+}
+
+template <typename T>
+void Channel<T>::send_with_deadline(producer* origin, const T& val, clock::time_point deadline) {
+    enqueue(origin, val, deadline);
+}
+
+template <typename T>
+bool Channel<T>::try_send(producer* origin, T&& val) {
+    return try_enqueue(origin, std::move(val), ttl.count() ? clock::now() + ttl : no_deadline);
+}
+
+template <typename T>
+bool Channel<T>::try_send(producer* origin, const T& val) {
+    return try_enqueue(origin, val, ttl.count() ? clock::now() + ttl : no_deadline);
+}
+
+template <typename T>
+template <typename U, typename Stop>
+bool Channel<T>::send(producer* origin, U&& val, const Stop& stop) {
+    return enqueue(origin, std::forward<U>(val), ttl.count() ? clock::now() + ttl : no_deadline, stop);
+}
+
+template <typename T>
+template <typename U, typename Stop>
+bool Channel<T>::enqueue(producer* origin, U&& val, clock::time_point deadline, const Stop& stop) {
+    send_clock timing(*this, origin);
+    if (refuse())
+        return false;
+    if (!acquire_credit(origin, stop))
+        return false;
+    size_t size;
+    if (!admit(origin, val, size, true, stop)) {
+        return_credit(origin);
+        return false;
+    }
+    message msg{std::forward<U>(val), stamping ? clock::now() : clock::time_point{}, deadline, origin,
+                sample(origin)};
+    threadsafe_queue<message>& target = fair ? *origin->lane : que;
+    // counted before the push so the consumer never sees fewer messages
+    // than it can pop
+    if (fair)
+        fair_count.fetch_add(1, std::memory_order_seq_cst);
+    // taken before the push: the consumer may release the message at once
+    if (pinning)
+        hold(origin);
+    if (!capacity) {
+        target.push(std::move(msg));
+        queued(origin, size);
+        return true;
+    }
+    bool may_block = accounting && overflow == overflow_policy::block && target.size() >= capacity;
+    clock::time_point since = may_block ? clock::now() : clock::time_point{};
+    bool accepted = target.push_bounded(std::move(msg), capacity, overflow,
+                                        [this](const message& old) { evicted(old); }, stop);
+    if (may_block)
+        add_blocked(origin, since);
+    if (!accepted) {
+        if (pinning)
+            drop(origin);
+        if (fair)
+            fair_count.fetch_sub(1, std::memory_order_relaxed);
+        // a blocked push only fails once closed or stopped
+        if (overflow == overflow_policy::block)
+            refused_after_wait();
+        else if (!stop.stop_requested()) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            arrival();
+        }
+        release_bytes(size);
+        return_credit(origin);
+        return false;
+    }
+    queued(origin, size);
+    return true;
+}
+
+template <typename T>
+template <typename U>
+bool Channel<T>::try_enqueue(producer* origin, U&& val, clock::time_point deadline) {
+    send_clock timing(*this, origin);
+    if (refuse())
+        return false;
+    if (!try_acquire_credit(origin))
+        return false;
+    size_t size;
+    if (!admit(origin, val, size, false)) {
+        return_credit(origin);
+        return false;
+    }
+    threadsafe_queue<message>& target = fair ? *origin->lane : que;
+    if (fair)
+        fair_count.fetch_add(1, std::memory_order_seq_cst);
+    std::unique_ptr<trace_context> trace = sample(origin);
+    if (pinning)
+        hold(origin);
+    // the value is only moved from once the tail lock is held
+    bool pushed = target.try_push([&] {
+        return message{std::forward<U>(val), stamping ? clock::now() : clock::time_point{}, deadline, origin,
+                       std::move(trace)};
+    }, capacity, overflow, [this](const message& old) { evicted(old); });
+    if (!pushed) {
+        if (pinning)
+            drop(origin);
+        if (fair)
+            fair_count.fetch_sub(1, std::memory_order_relaxed);
+        release_bytes(size);
+        return_credit(origin);
+        return false;
+    }
+    queued(origin, size);
+    return true;
+}
+
+template <typename T>
+void Channel<T>::queued(producer* origin, size_t size) {
+    arrival();
+    if (accounting) {
+        add(origin->usage.messages, 1);
+        add(origin->usage.bytes, size);
+    }
+    if (fair)
+        wake_fair_consumer();
+    check_high_watermark();
+}
+
+template <typename T>
+void Channel<T>::arrival() {
+    if (rate_window.count())
+        arrived.fetch_add(1, std::memory_order_relaxed);
+}
+
+template <typename T>
+std::unique_ptr<trace_context> Channel<T>::sample(producer* origin) {
+    bool start = trace_every && (origin->sends.fetch_add(1, std::memory_order_relaxed) + 1) % trace_every == 0;
+    return tracing::attach(start);
+}
+
+template <typename T>
+void Channel<T>::add_blocked(producer* origin, clock::time_point since) {
+    add(origin->usage.blocked_ns, uint64_t((clock::now() - since).count()));
+}
+
+template <typename T>
+void Channel<T>::check_high_watermark() {
+    if (!high_watermark || depth() < high_watermark ||
+        _congested.load(std::memory_order_relaxed))
+        return;
+    bool expected = false;
+    if (!_congested.compare_exchange_strong(expected, true, std::memory_order_acq_rel))
+        return;
+    high_crossings.fetch_add(1, std::memory_order_relaxed);
+    if (on_watermark)
+        on_watermark(true);
+}
+
+template <typename T>
+void Channel<T>::check_low_watermark() {
+    if (!high_watermark || !_congested.load(std::memory_order_relaxed) ||
+        depth() > low_watermark)
+        return;
+    bool expected = true;
+    if (!_congested.compare_exchange_strong(expected, false, std::memory_order_acq_rel))
+        return;
+    if (on_watermark)
+        on_watermark(false);
+}
+
+template <typename T>
+void Channel<T>::on_dequeued() {
+    check_low_watermark();
+    if (rate_window.count())
+        sample_rates();
+}
+
+template <typename T>
+void Channel<T>::sample_rates() {
+    clock::time_point now = clock::now();
+    if (rates_sampled == clock::time_point{}) {
+        rates_sampled = now;
+        return;
+    }
+    // average over samples at least a sixteenth of the window apart
+    std::chrono::duration<double> elapsed = now - rates_sampled;
+    if (elapsed < rate_window / 16)
+        return;
+    uint64_t served = received.load(std::memory_order_relaxed) + expired.load(std::memory_order_relaxed) +
+                      aqm_dropped.load(std::memory_order_relaxed);
+    uint64_t arrivals = arrived.load(std::memory_order_relaxed);
+    double alpha = 1 - std::exp(-elapsed / std::chrono::duration<double>(rate_window));
+    double in = arrival_rate.load(std::memory_order_relaxed);
+    double out = service_rate.load(std::memory_order_relaxed);
+    in += alpha * (double(arrivals - arrivals_seen) / elapsed.count() - in);
+    out += alpha * (double(served - served_seen) / elapsed.count() - out);
+    arrival_rate.store(in, std::memory_order_relaxed);
+    service_rate.store(out, std::memory_order_relaxed);
+    rates_published.store(now.time_since_epoch().count(), std::memory_order_relaxed);
+    rates_sampled = now;
+    arrivals_seen = arrivals;
+    served_seen = served;
+}
+
+// Worked out from the live depth at read time. A consumer that stops
+// dequeuing stops sampling too, so estimates older than the window say
+// nothing about when the backlog clears.
+template <typename T>
+double Channel<T>::time_to_drain() {
+    size_t queued = depth();
+    if (!rate_window.count() || queued == 0)
+        return 0.0;
+    clock::time_point published{clock::duration(rates_published.load(std::memory_order_relaxed))};
+    if (published == clock::time_point{} || clock::now() - published > rate_window)
+        return std::numeric_limits<double>::infinity();
+    double in = arrival_rate.load(std::memory_order_relaxed);
+    double out = service_rate.load(std::memory_order_relaxed);
+    return out > in ? double(queued) / (out - in) : std::numeric_limits<double>::infinity();
+}
+
+template <typename T>
+bool Channel<T>::refuse() {
+    if (!shutting_down.load(std::memory_order_acquire))
+        return false;
+    rejected.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+// a sender woken by close gives up rather than queue past its limits
+template <typename T>
+bool Channel<T>::refused_after_wait() {
+    if (!_closed.load(std::memory_order_seq_cst))
+        return false;
+    rejected.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+template <typename T>
+bool Channel<T>::congested() {
+    return _congested.load(std::memory_order_acquire);
+}
+
+template <typename T>
+void Channel<T>::wake_fair_consumer() {
+    if (sleeping.load(std::memory_order_seq_cst)) {
+        { std::lock_guard<std::mutex> lock(wait_mutex); }
+        fair_cond.notify_one();
+    }
+}
+
+template <typename T>
+std::shared_ptr<typename Channel<T>::message> Channel<T>::next_fair() {
+    if (fair_count.load(std::memory_order_acquire) == 0)
+        return nullptr;
+    uint64_t epoch = producers_epoch.load(std::memory_order_acquire);
+    if (rotation_epoch != epoch) {
+        std::lock_guard<std::mutex> lock(producers_mutex);
+        rotation.clear();
+        for (auto& p : producers)
+            rotation.push_back(p.get());
+        retired.clear();
+        rotation_epoch = epoch;
+        in_turn = false;
+        if (turn >= rotation.size())
+            turn = 0;
+    }
+    if (rotation.empty())
+        return nullptr;
+    // every non-empty lane is reached within two passes
+    for (size_t visited = 0; visited < 2 * rotation.size() + 1; ++visited) {
+        producer* p = rotation[turn];
+        if (!in_turn) {
+            p->deficit += p->weight.load(std::memory_order_relaxed);
+            in_turn = true;
+        }
+        // size() is a lock-free read; idle lanes cost no lock traffic
+        std::shared_ptr<message> data = p->deficit && p->lane->size() ? p->lane->try_pop() : nullptr;
+        if (data) {
+            --p->deficit;
+            fair_count.fetch_sub(1, std::memory_order_seq_cst);
+        }
+        bool drained = p->lane->size() == 0;
+        if (!data || p->deficit == 0 || drained) {
+            if (!data || drained)
+                p->deficit = 0;
+            in_turn = false;
+            turn = (turn + 1) % rotation.size();
+        }
+        if (data)
+            return data;
+    }
+    return nullptr;
+}
+
+template <typename T>
+template <typename Stop>
+std::shared_ptr<typename Channel<T>::message> Channel<T>::pop_fair(bool wait, clock::time_point deadline,
+                                                                   const Stop& stop) {
+    [[maybe_unused]] auto wake = wake_on_stop(stop, [this]{
+        { std::lock_guard<std::mutex> lock(wait_mutex); }
+        fair_cond.notify_all();
+    });
+    while (true) {
+        if (std::shared_ptr<message> data = next_fair())
+            return data;
+        if (!wait)
+            return nullptr;
+        std::unique_lock<std::mutex> lock(wait_mutex);
+        sleeping.store(true, std::memory_order_seq_cst);
+        auto ready = [&]{
+            return fair_count.load(std::memory_order_seq_cst) != 0 || _closed || stop.stop_requested();
+        };
+        bool woken = true;
+        if (deadline == no_deadline)
+            fair_cond.wait(lock, ready);
+        else
+            woken = fair_cond.wait_until(lock, deadline, ready);
+        sleeping.store(false, std::memory_order_relaxed);
+        if (fair_count.load(std::memory_order_acquire) == 0 && (_closed || !woken || stop.stop_requested()))
+            return nullptr;
+    }
+}
+
+template <typename T>
+size_t Channel<T>::depth() {
+    return fair ? fair_count.load(std::memory_order_relaxed) : que.size();
+}
+
+template <typename T>
+size_t Channel<T>::size() {
+    return depth();
+}
+
+template <typename T>
+template <typename Stop>
+bool Channel<T>::admit(producer* origin, const T& val, size_t& size, bool wait, const Stop& stop) {
+    size = track_bytes || accounting ? message_size<T>{}(val) : 0;
+    if (!track_bytes)
+        return true;
+    // close_channel wakes the budgets so blocked senders see _closed
+    stop_or_flag<Stop> until{stop, _closed};
+    auto charge = [&](MemoryBudget& b) {
+        if (!wait)
+            return b.try_acquire(size);
+        if (!accounting)
+            return b.acquire(size, until);
+        if (b.try_acquire(size))
+            return true;
+        clock::time_point since = clock::now();
+        bool charged = b.acquire(size, until);
+        add_blocked(origin, since);
+        return charged;
+    };
+    if (byte_limit && !charge(*byte_limit)) {
+        if (wait)
+            refused_after_wait();
+        return false;
+    }
+    if (budget && !charge(*budget)) {
+        if (byte_limit)
+            byte_limit->release(size);
+        if (wait && refused_after_wait())
+            return false;
+        if (wait && !until.stop_requested()) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            arrival();
+        }
+        return false;
+    }
+    size_t now = bytes.fetch_add(size, std::memory_order_relaxed) + size;
+    size_t peak = peak_bytes.load(std::memory_order_relaxed);
+    while (now > peak && !peak_bytes.compare_exchange_weak(peak, now, std::memory_order_relaxed));
+    return true;
+}
+
+template <typename T>
+template <typename Stop>
+bool Channel<T>::acquire_credit(producer* origin, const Stop& stop) {
+    if (!credits || try_acquire_credit(origin))
+        return true;
+    [[maybe_unused]] auto wake = wake_on_stop(stop, [origin]{
+        { std::lock_guard<std::mutex> lock(origin->mutex); }
+        origin->credit_cond.notify_all();
+    });
+    std::unique_lock<std::mutex> lock(origin->mutex);
+    // counted before the reservation is retried, so a credit returned
+    // after a failed retry always sees this waiter
+    origin->credit_waiters.fetch_add(1, std::memory_order_seq_cst);
+    clock::time_point since = accounting ? clock::now() : clock::time_point{};
+    bool acquired = false;
+    origin->credit_cond.wait(lock, [&]{
+        return _closed || stop.stop_requested() || (acquired = try_acquire_credit(origin));
+    });
+    origin->credit_waiters.fetch_sub(1, std::memory_order_relaxed);
+    if (accounting)
+        add_blocked(origin, since);
+    if (!acquired)
+        refused_after_wait();
+    return acquired;
+}
+
+template <typename T>
+bool Channel<T>::try_acquire_credit(producer* origin) {
+    if (!credits)
+        return true;
+    size_t used = origin->outstanding.load(std::memory_order_seq_cst);
+    do {
+        if (used >= credits)
+            return false;
+    } while (!origin->outstanding.compare_exchange_weak(used, used + 1, std::memory_order_seq_cst));
+    return true;
+}
+
+template <typename T>
+void Channel<T>::return_credit(producer* origin) {
+    if (!credits)
+        return;
+    origin->outstanding.fetch_sub(1, std::memory_order_seq_cst);
+    // a Sender shared by several threads may have several waiters, and one
+    // woken by its stop token would swallow a notify_one
+    if (origin->credit_waiters.load(std::memory_order_seq_cst)) {
+        { std::lock_guard<std::mutex> lock(origin->mutex); }
+        origin->credit_cond.notify_all();
+    }
+}
+
+template <typename T>
+typename Channel<T>::producer* Channel<T>::add_producer() {
+    std::lock_guard<std::mutex> lock(producers_mutex);
+    producers.emplace_back(new producer());
+    producer* p = producers.back().get();
+    p->id = next_producer_id++;
+    p->slot = producers.size() - 1;
+    if (fair)
+        p->lane.reset(new threadsafe_queue<message>(pool ? pool.get() : std::pmr::new_delete_resource()));
+    producers_epoch.fetch_add(1, std::memory_order_release);
+    return p;
+}
+
+template <typename T>
+void Channel<T>::hold(producer* origin) {
+    origin->refs.fetch_add(1, std::memory_order_relaxed);
 }
 
 template <typename T>
-void Channel<T>::send(const T& val) {
-    que.push(val);
+void Channel<T>::drop(producer* origin) {
+    if (origin->refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        return;
+    std::lock_guard<std::mutex> lock(producers_mutex);
+    std::unique_ptr<producer> gone = std::move(producers[origin->slot]);
+    if (origin->slot != producers.size() - 1) {
+        producers[origin->slot] = std::move(producers.back());
+        producers[origin->slot]->slot = origin->slot;
+    }
+    producers.pop_back();
+    producers_epoch.fetch_add(1, std::memory_order_release);
+    // the consumer may still be walking a rotation that holds it
+    if (fair)
+        retired.push_back(std::move(gone));
 }
 
 template <typename T>
-std::optional<T> Channel<T>::recv() {
-    return *que.wait_and_pop();
+void Channel<T>::set_weight(producer* origin, uint32_t weight) {
+    origin->weight.store(weight ? weight : 1, std::memory_order_relaxed);
+}
+
+template <typename T>
+size_t Channel<T>::available_credits(producer* origin) {
+    if (!credits)
+        return SIZE_MAX;
+    size_t used = origin->outstanding.load(std::memory_order_relaxed);
+    return used < credits ? credits - used : 0;
+}
+
+template <typename T>
+void Channel<T>::released(const message& msg) {
+    if (track_bytes)
+        release_bytes(message_size<T>{}(msg.value));
+    return_credit(msg.origin);
+    if (dequeue_waiters.load(std::memory_order_seq_cst)) {
+        { std::lock_guard<std::mutex> lock(dequeue_mutex); }
+        dequeue_cond.notify_all();
+    }
+    if (pinning)
+        drop(msg.origin);
+}
+
+// a queued message pushed out by drop_oldest or overwrite
+template <typename T>
+void Channel<T>::evicted(const message& old) {
+    if (fair)
+        fair_count.fetch_sub(1, std::memory_order_seq_cst);
+    dropped.fetch_add(1, std::memory_order_relaxed);
+    released(old);
+}
+
+template <typename T>
+bool Channel<T>::flush(producer* origin, clock::time_point deadline) {
+    // everything this sender queued so far lies before the queue's current
+    // push count, so the watermark passes once as many have been popped
+    threadsafe_queue<message>& q = fair ? *origin->lane : que;
+    size_t target = q.pushes();
+    auto passed = [&]{ return q.pops() >= target; };
+    if (passed())
+        return true;
+    std::unique_lock<std::mutex> lock(dequeue_mutex);
+    dequeue_waiters.fetch_add(1, std::memory_order_seq_cst);
+    bool flushed = true;
+    if (deadline == no_deadline)
+        dequeue_cond.wait(lock, passed);
+    else
+        flushed = dequeue_cond.wait_until(lock, deadline, passed);
+    dequeue_waiters.fetch_sub(1, std::memory_order_relaxed);
+    return flushed;
+}
+
+template <typename T>
+void Channel<T>::consumed(const message& msg) {
+    received.store(received.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    released(msg);
+    on_dequeued();
+}
+
+template <typename T>
+void Channel<T>::release_bytes(size_t size) {
+    if (!track_bytes)
+        return;
+    bytes.fetch_sub(size, std::memory_order_relaxed);
+    if (byte_limit)
+        byte_limit->release(size);
+    if (budget)
+        budget->release(size);
+}
+
+template <typename T>
+channel_stats Channel<T>::stats() {
+    channel_stats s;
+    s.depth = depth();
+    s.received = received.load(std::memory_order_relaxed);
+    s.dropped = dropped.load(std::memory_order_relaxed);
+    s.bytes_in_flight = bytes.load(std::memory_order_relaxed);
+    s.peak_bytes = peak_bytes.load(std::memory_order_relaxed);
+    s.max_bytes = byte_limit ? byte_limit->limit() : 0;
+    s.capacity = capacity;
+    s.aqm_dropped = aqm_dropped.load(std::memory_order_relaxed);
+    s.aqm_marked = aqm_marked.load(std::memory_order_relaxed);
+    s.expired = expired.load(std::memory_order_relaxed);
+    s.congested = _congested.load(std::memory_order_relaxed);
+    s.high_crossings = high_crossings.load(std::memory_order_relaxed);
+    s.rejected = rejected.load(std::memory_order_relaxed);
+    if (tracking_latency)
+        s.latency = latency.snapshot();
+    s.arrival_rate = arrival_rate.load(std::memory_order_relaxed);
+    s.service_rate = service_rate.load(std::memory_order_relaxed);
+    s.time_to_drain = time_to_drain();
+    if (accounting) {
+        std::lock_guard<std::mutex> lock(producers_mutex);
+        for (auto& p : producers)
+            s.producers.push_back(producer_stats{
+                p->id,
+                p->usage.messages.load(std::memory_order_relaxed),
+                p->usage.bytes.load(std::memory_order_relaxed),
+                std::chrono::nanoseconds(p->usage.blocked_ns.load(std::memory_order_relaxed)),
+                std::chrono::nanoseconds(p->usage.send_ns.load(std::memory_order_relaxed))});
+    }
+    return s;
+}
+
+template <typename T>
+template <typename Stop>
+std::shared_ptr<typename Channel<T>::message> Channel<T>::pop_waiting(clock::time_point deadline,
+                                                                      const Stop& stop) {
+    // do not sit on a partial batch while waiting
+    if (!dead.messages.empty() || !dead.values.empty())
+        hand_off();
+    if (fair)
+        return pop_fair(true, deadline, stop);
+    if (pool && trim.idle_period.count() && low_since && !trimmed) {
+        clock::time_point trim_at = *low_since + trim.idle_period;
+        if (std::shared_ptr<message> data = que.wait_and_pop_until(std::min(trim_at, deadline), stop))
+            return data;
+        if (stop.stop_requested() || clock::now() >= deadline)
+            return nullptr;
+        if (!_closed) {
+            pool->trim();
+            trimmed = true;
+        }
+    }
+    if (deadline == no_deadline)
+        return que.wait_and_pop(stop);
+    return que.wait_and_pop_until(deadline, stop);
+}
+
+template <typename T>
+void Channel<T>::observe_depth() {
+    if (!pool || !trim.idle_period.count())
+        return;
+    if (depth() > trim.low_depth) {
+        low_since.reset();
+        trimmed = false;
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (!low_since)
+        low_since = now;
+    else if (!trimmed && now - *low_since >= trim.idle_period) {
+        pool->trim();
+        trimmed = true;
+    }
+}
+
+template <typename T>
+bool Channel<T>::screen(message& msg) {
+    last_marked = false;
+    if (msg.deadline != no_deadline && clock::now() > msg.deadline) {
+        expired.fetch_add(1, std::memory_order_relaxed);
+        released(msg);
+        on_dequeued();
+        if (dead_letter)
+            dead_letter(std::move(msg.value));
+        return false;
+    }
+    if (!aqm.enabled())
+        return true;
+    switch (aqm.on_dequeue(msg.enqueued, clock::now(), depth() == 0)) {
+        case codel::verdict::pass:
+            return true;
+        case codel::verdict::mark:
+            last_marked = true;
+            aqm_marked.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        case codel::verdict::drop:
+            break;
+    }
+    aqm_dropped.fetch_add(1, std::memory_order_relaxed);
+    dropped.fetch_add(1, std::memory_order_relaxed);
+    released(msg);
+    on_dequeued();
+    return false;
+}
+
+template <typename T>
+T Channel<T>::deliver(message& msg) {
+    if (tracking_latency)
+        latency.record(clock::now() - msg.enqueued);
+    tracing::received(std::move(msg.trace), name);
+    consumed(msg);
+    observe_depth();
+    return std::move(msg.value);
+}
+
+// The receives end the thread's current trace hop before they wait, so a
+// hop's processing time excludes the wait for the next message.
+template <typename T>
+template <typename Stop>
+std::optional<T> Channel<T>::recv(clock::time_point deadline, const Stop& stop) {
+    tracing::finish();
+    return next(deadline, stop);
 }
 
 template <typename T>
 std::optional<T> Channel<T>::try_recv() {
-    return *que.try_pop();
+    tracing::finish();
+    return try_next();
+}
+
+template <typename T>
+template <typename Stop>
+std::optional<T> Channel<T>::next(clock::time_point deadline, const Stop& stop) {
+    while (std::shared_ptr<message> data = pop_waiting(deadline, stop)) {
+        if (screen(*data)) {
+            std::optional<T> val = deliver(*data);
+            bury(std::move(data));
+            return val;
+        }
+        bury(std::move(data));
+    }
+    return std::nullopt;
+}
+
+template <typename T>
+template <typename Stop>
+size_t Channel<T>::recv_batch(std::vector<T>& out, size_t max, const Stop& stop) {
+    if (!max)
+        return 0;
+    tracing::finish();
+    std::optional<T> first = next(no_deadline, stop);
+    if (!first)
+        return 0;
+    out.push_back(std::move(*first));
+    size_t n = 1;
+    for (; n < max; ++n) {
+        std::optional<T> val = try_next();
+        if (!val)
+            break;
+        out.push_back(std::move(*val));
+    }
+    return n;
+}
+
+template <typename T>
+std::optional<T> Channel<T>::try_next() {
+    while (std::shared_ptr<message> data = fair ? pop_fair(false) : que.try_pop()) {
+        if (screen(*data)) {
+            std::optional<T> val = deliver(*data);
+            bury(std::move(data));
+            return val;
+        }
+        bury(std::move(data));
+    }
+    if (!dead.messages.empty() || !dead.values.empty())
+        hand_off();
+    observe_depth();
+    return std::nullopt;
+}
+
+template <typename T>
+void Channel<T>::bury(std::shared_ptr<message>&& msg) {
+    if (!reclaim_batch)
+        return;
+    dead.messages.push_back(std::move(msg));
+    if (dead.messages.size() + dead.values.size() >= reclaim_batch)
+        hand_off();
+}
+
+template <typename T>
+void Channel<T>::retire(T&& val) {
+    if (!reclaim_batch)
+        return;
+    dead.values.push_back(std::move(val));
+    if (dead.messages.size() + dead.values.size() >= reclaim_batch)
+        hand_off();
+}
+
+template <typename T>
+void Channel<T>::hand_off() {
+    Reclaimer::instance().retire(std::move(dead));
+    dead = graveyard{};
+    reclaimed = true;
+}
+
+template <typename T>
+bool Channel<T>::marked() {
+    return last_marked;
+}
+
+template <typename T>
+void Channel<T>::set_dead_letter(std::function<void(T&&)> handler) {
+    dead_letter = std::move(handler);
+}
+
+template <typename T>
+std::optional<arena_stats> Channel<T>::memory_stats() {
+    if (!pool)
+        return std::nullopt;
+    return pool->stats();
+}
+
+template <typename T>
+arena_stats Channel<T>::prepare(size_t capacity, bool lock_pages) {
+    if (!pool)
+        throw std::logic_error("Channel has no arena to prepare.");
+    return pool->reserve(capacity * threadsafe_queue<message>::element_footprint, lock_pages);
+}
+
+template <typename T>
+size_t Channel<T>::shrink_to_fit() {
+    return pool ? pool->trim() : 0;
 }
 
 template <typename T>
 void Channel<T>::close_channel() {
     _closed = true;
+    que.close();
+    {
+    std::lock_guard<std::mutex> lock(wait_mutex);
+    }
+    fair_cond.notify_all();
+    if (byte_limit)
+        byte_limit->wake();
+    if (budget)
+        budget->wake();
+    std::lock_guard<std::mutex> lock(producers_mutex);
+    for (auto& p : producers) {
+        if (p->lane)
+            p->lane->close();
+        { std::lock_guard<std::mutex> credit_lock(p->mutex); }
+        p->credit_cond.notify_all();
+    }
+}
+
+template <typename T>
+shutdown_report<T> Channel<T>::shutdown(clock::time_point deadline) {
+    auto dequeued = [&]{
+        return received.load(std::memory_order_relaxed) + expired.load(std::memory_order_relaxed) +
+               aqm_dropped.load(std::memory_order_relaxed);
+    };
+    shutting_down.store(true, std::memory_order_seq_cst);
+    uint64_t before = dequeued();
+    close_channel();
+    {
+    // released() follows every dequeue, after the count it drops
+    auto drained = [&]{
+        return fair ? fair_count.load(std::memory_order_seq_cst) == 0 : que.pops() == que.pushes();
+    };
+    std::unique_lock<std::mutex> lock(dequeue_mutex);
+    dequeue_waiters.fetch_add(1, std::memory_order_seq_cst);
+    dequeue_cond.wait_until(lock, deadline, drained);
+    dequeue_waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+    shutdown_report<T> report;
+    auto hand_back = [&](threadsafe_queue<message>& q) {
+        while (std::shared_ptr<message> data = q.try_pop()) {
+            if (fair)
+                fair_count.fetch_sub(1, std::memory_order_relaxed);
+            released(*data);
+            report.returned.push_back(std::move(data->value));
+        }
+    };
+    if (fair) {
+        // held so that releasing their last messages cannot free them here
+        std::vector<producer*> lanes;
+        {
+        std::lock_guard<std::mutex> lock(producers_mutex);
+        for (auto& p : producers) {
+            hold(p.get());
+            lanes.push_back(p.get());
+        }
+        }
+        for (producer* p : lanes) {
+            hand_back(*p->lane);
+            drop(p);
+        }
+    } else {
+        hand_back(que);
+    }
+    report.drained = dequeued() - before;
+    return report;
 }
 
 template <typename T>
@@ -73,39 +1257,210 @@ template <typename T>
 class Sender {
     private:
         std::shared_ptr<Channel<T>> channel;
+        typename Channel<T>::producer* origin;
+        // values send_or_buffer could not publish yet, oldest first; the
+        // threads sharing a Sender take turns on them
+        struct parked_values {
+            std::mutex mutex;
+            std::deque<T> values;
+        };
+        std::unique_ptr<parked_values> _parked;
 
         Sender(std::shared_ptr<Channel<T>> ch)
-            : channel(ch) {};
+            : channel(ch), origin(ch->add_producer()), _parked(new parked_values()) {};
         
         void moved() {
             if (!channel)
                 throw std::logic_error("Sender has been moved.");
         }
+        bool publish_parked();
 
-        friend std::tuple<Sender<T>, Receiver<T>> make_channel<T>();
+        friend std::tuple<Sender<T>, Receiver<T>> make_channel<T>(const channel_options& options);
 
     public:
+        // every copy is a separate producer with its own credit window,
+        // released when the copy is destroyed
+        Sender(const Sender<T>& other)
+            : channel(other.channel), origin(channel ? channel->add_producer() : nullptr),
+              _parked(new parked_values()) {}
+        Sender<T>& operator=(const Sender<T>& other) {
+            if (this != &other)
+                *this = Sender<T>(other);
+            return *this;
+        }
+        Sender(Sender<T>&&) = default;
+        Sender<T>& operator=(Sender<T>&& other) {
+            if (this != &other) {
+                if (channel)
+                    channel->drop(origin);
+                channel = std::move(other.channel);
+                origin = other.origin;
+                _parked = std::move(other._parked);
+            }
+            return *this;
+        }
+        ~Sender() {
+            if (channel)
+                channel->drop(origin);
+        }
+
         Sender<T>& send(T&& val);
         Sender<T>& send(const T& val);
+        Sender<T>& send_with_deadline(T&& val, std::chrono::steady_clock::time_point deadline);
+        Sender<T>& send_with_deadline(const T& val, std::chrono::steady_clock::time_point deadline);
+#ifdef __cpp_lib_jthread
+        // like send, but gives up once stop is requested while blocked on
+        // credits, bytes or capacity; false when the value was not queued
+        bool send(T&& val, std::stop_token stop);
+        bool send(const T& val, std::stop_token stop);
+#endif
+        // Publishes without ever waiting: fails when another producer holds
+        // the tail, the queue is at capacity, or credits or bytes are short.
+        // Under drop_oldest and overwrite a full queue evicts its oldest
+        // message instead, as send does, unless the consumer holds the head.
+        // On failure val is left untouched.
+        bool try_send(T&& val);
+        bool try_send(const T& val);
+        // try_send, parking the value on this sender when it fails; parked
+        // values go out first, in order, on the next call or retry_parked().
+        // Threads sharing the Sender share its parked values and take a
+        // lock around them, held only for the non-blocking attempts.
+        // Values still parked when the sender is destroyed are discarded.
+        bool send_or_buffer(T&& val);
+        bool send_or_buffer(const T& val);
+        // true once nothing is parked
+        bool retry_parked();
+        size_t parked() const;
+        // sends blocked on credits, bytes or capacity give up, counted in
+        // stats().rejected
         void close();
         bool closed();
+        // Refuses further sends and closes the channel, waits until the
+        // consumer has emptied it or deadline passes, then takes back
+        // whatever is still queued.
+        shutdown_report<T> shutdown(std::chrono::steady_clock::time_point deadline);
+        // Waits until every message this sender queued so far has been
+        // received or dropped; flush_for gives up after timeout. Without
+        // fair scheduling that includes other senders' earlier messages.
+        void flush();
+        template <typename Rep, typename Period>
+        bool flush_for(const std::chrono::duration<Rep, Period>& timeout);
+        // messages this sender may still queue before it blocks
+        size_t credits();
+        // share of the consumer in fair mode, in messages per round
+        void set_weight(uint32_t weight);
+        // lock-free read of the watermark state
+        bool congested();
+        // matches producer_stats::id
+        uint64_t id();
+        // estimated seconds until the backlog clears at current rates,
+        // infinity while arrivals keep up with service or while the
+        // consumer has not dequeued for a whole window; needs rate_window
+        double time_to_drain();
 
 };
 
 template <typename T>
 Sender<T>& Sender<T>::send(T&& val) {
     moved();
-    channel->send(std::move(val));
+    channel->send(origin, std::move(val));
     return *this;
 }
 
 template <typename T>
 Sender<T>& Sender<T>::send(const T& val) {
     moved();
-    channel->send(val);
+    channel->send(origin, val);
+    return *this;
+}
+
+template <typename T>
+Sender<T>& Sender<T>::send_with_deadline(T&& val, std::chrono::steady_clock::time_point deadline) {
+    moved();
+    channel->send_with_deadline(origin, std::move(val), deadline);
     return *this;
 }
 
+template <typename T>
+Sender<T>& Sender<T>::send_with_deadline(const T& val, std::chrono::steady_clock::time_point deadline) {
+    moved();
+    channel->send_with_deadline(origin, val, deadline);
+    return *this;
+}
+
+#ifdef __cpp_lib_jthread
+template <typename T>
+bool Sender<T>::send(T&& val, std::stop_token stop) {
+    moved();
+    return channel->send(origin, std::move(val), stop);
+}
+
+template <typename T>
+bool Sender<T>::send(const T& val, std::stop_token stop) {
+    moved();
+    return channel->send(origin, val, stop);
+}
+#endif
+
+template <typename T>
+bool Sender<T>::try_send(T&& val) {
+    moved();
+    return channel->try_send(origin, std::move(val));
+}
+
+template <typename T>
+bool Sender<T>::try_send(const T& val) {
+    moved();
+    return channel->try_send(origin, val);
+}
+
+template <typename T>
+bool Sender<T>::send_or_buffer(T&& val) {
+    moved();
+    std::lock_guard<std::mutex> lock(_parked->mutex);
+    if (publish_parked() && channel->try_send(origin, std::move(val)))
+        return true;
+    _parked->values.push_back(std::move(val));
+    return false;
+}
+
+template <typename T>
+bool Sender<T>::send_or_buffer(const T& val) {
+    moved();
+    std::lock_guard<std::mutex> lock(_parked->mutex);
+    if (publish_parked() && channel->try_send(origin, val))
+        return true;
+    _parked->values.push_back(val);
+    return false;
+}
+
+template <typename T>
+bool Sender<T>::retry_parked() {
+    moved();
+    std::lock_guard<std::mutex> lock(_parked->mutex);
+    return publish_parked();
+}
+
+// called with _parked->mutex held
+template <typename T>
+bool Sender<T>::publish_parked() {
+    std::deque<T>& values = _parked->values;
+    while (!values.empty()) {
+        if (!channel->try_send(origin, std::move(values.front())))
+            return false;
+        values.pop_front();
+    }
+    return true;
+}
+
+template <typename T>
+size_t Sender<T>::parked() const {
+    if (!_parked)
+        return 0;
+    std::lock_guard<std::mutex> lock(_parked->mutex);
+    return _parked->values.size();
+}
+
 template <typename T>
 void Sender<T>::close() {
     moved();
@@ -118,6 +1473,56 @@ bool Sender<T>::closed() {
     return channel->closed();
 }
 
+template <typename T>
+shutdown_report<T> Sender<T>::shutdown(std::chrono::steady_clock::time_point deadline) {
+    moved();
+    return channel->shutdown(deadline);
+}
+
+template <typename T>
+void Sender<T>::flush() {
+    moved();
+    channel->flush(origin, std::chrono::steady_clock::time_point::max());
+}
+
+template <typename T>
+template <typename Rep, typename Period>
+bool Sender<T>::flush_for(const std::chrono::duration<Rep, Period>& timeout) {
+    moved();
+    return channel->flush(origin, std::chrono::steady_clock::now() +
+                          std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout));
+}
+
+template <typename T>
+size_t Sender<T>::credits() {
+    moved();
+    return channel->available_credits(origin);
+}
+
+template <typename T>
+void Sender<T>::set_weight(uint32_t weight) {
+    moved();
+    channel->set_weight(origin, weight);
+}
+
+template <typename T>
+bool Sender<T>::congested() {
+    moved();
+    return channel->congested();
+}
+
+template <typename T>
+double Sender<T>::time_to_drain() {
+    moved();
+    return channel->time_to_drain();
+}
+
+template <typename T>
+uint64_t Sender<T>::id() {
+    moved();
+    return origin->id;
+}
+
 template<typename T>
 class Receiver {
     private:
@@ -131,12 +1536,40 @@ class Receiver {
                 throw std::logic_error("Receiver has been moved.");
         }
 
-        friend std::tuple<Sender<T>, Receiver<T>> make_channel<T>();
+        friend std::tuple<Sender<T>, Receiver<T>> make_channel<T>(const channel_options& options);
 
     public:
         std::optional<T> recv();
         std::optional<T> try_recv();
+        // nullopt on timeout as well as once closed and drained
+        template<typename Rep, typename Period>
+        std::optional<T> recv_for(const std::chrono::duration<Rep, Period>& timeout);
+        // waits for one message, then appends up to max - 1 more that are
+        // already queued; returns how many were appended
+        size_t recv_batch(std::vector<T>& out, size_t max);
+#ifdef __cpp_lib_jthread
+        // the blocking receives above, also returning early once stop is
+        // requested; the stop callback wakes only this receiver
+        std::optional<T> recv(std::stop_token stop);
+        template<typename Rep, typename Period>
+        std::optional<T> recv_for(const std::chrono::duration<Rep, Period>& timeout, std::stop_token stop);
+        size_t recv_batch(std::vector<T>& out, size_t max, std::stop_token stop);
+#endif
+        // whether queue management marked the message last received
+        bool marked();
+        bool congested();
+        // messages queued; a lock-free read, cheap enough to poll
+        size_t size();
+        // called on the receiving thread with messages whose deadline passed
+        void set_dead_letter(std::function<void(T&&)> handler);
+        // destroys a received value on the reclaimer thread when
+        // reclaim_batch is set, here otherwise
+        void retire(T&& val);
         bool closed();
+        channel_stats stats();
+        std::optional<arena_stats> memory_stats();
+        arena_stats prepare(size_t capacity, bool lock_pages = false);
+        size_t shrink_to_fit();
 
         Receiver(const Receiver<T>&)=delete;
         Receiver<T>& operator=(const Receiver<T>&)=delete;
@@ -160,9 +1593,7 @@ class Receiver {
 
                 iterator(): receiver(nullptr) {}
 		        iterator(Receiver<T>& receiver): receiver(&receiver) {
-			        if (this->receiver->closed())
-                         this->receiver = nullptr;
-			        else next();
+			        next();
 		        }
 	
 		        reference operator*() { return current.value(); }
@@ -202,16 +1633,117 @@ std::optional<T> Receiver<T>::try_recv() {
     return channel->try_recv();
 }
 
+template<typename T>
+template<typename Rep, typename Period>
+std::optional<T> Receiver<T>::recv_for(const std::chrono::duration<Rep, Period>& timeout) {
+    moved();
+    return channel->recv(std::chrono::steady_clock::now() +
+                         std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout));
+}
+
+template<typename T>
+size_t Receiver<T>::recv_batch(std::vector<T>& out, size_t max) {
+    moved();
+    return channel->recv_batch(out, max);
+}
+
+#ifdef __cpp_lib_jthread
+template<typename T>
+std::optional<T> Receiver<T>::recv(std::stop_token stop) {
+    moved();
+    return channel->recv(std::chrono::steady_clock::time_point::max(), stop);
+}
+
+template<typename T>
+template<typename Rep, typename Period>
+std::optional<T> Receiver<T>::recv_for(const std::chrono::duration<Rep, Period>& timeout, std::stop_token stop) {
+    moved();
+    return channel->recv(std::chrono::steady_clock::now() +
+                         std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout), stop);
+}
+
+template<typename T>
+size_t Receiver<T>::recv_batch(std::vector<T>& out, size_t max, std::stop_token stop) {
+    moved();
+    return channel->recv_batch(out, max, stop);
+}
+#endif
+
+template<typename T>
+bool Receiver<T>::marked() {
+    moved();
+    return channel->marked();
+}
+
+template<typename T>
+bool Receiver<T>::congested() {
+    moved();
+    return channel->congested();
+}
+
+template<typename T>
+size_t Receiver<T>::size() {
+    moved();
+    return channel->size();
+}
+
+template<typename T>
+void Receiver<T>::retire(T&& val) {
+    moved();
+    channel->retire(std::move(val));
+}
+
+template<typename T>
+void Receiver<T>::set_dead_letter(std::function<void(T&&)> handler) {
+    moved();
+    channel->set_dead_letter(std::move(handler));
+}
+
 template<typename T>
 bool Receiver<T>::closed() {
     moved();
     return channel->closed();
 }
 
+template<typename T>
+channel_stats Receiver<T>::stats() {
+    moved();
+    return channel->stats();
+}
+
+template<typename T>
+std::optional<arena_stats> Receiver<T>::memory_stats() {
+    moved();
+    return channel->memory_stats();
+}
+
+template<typename T>
+arena_stats Receiver<T>::prepare(size_t capacity, bool lock_pages) {
+    moved();
+    return channel->prepare(capacity, lock_pages);
+}
+
+template<typename T>
+size_t Receiver<T>::shrink_to_fit() {
+    moved();
+    return channel->shrink_to_fit();
+}
+
 template <typename T>
-std::tuple<Sender<T>, Receiver<T>> make_channel() {
+std::tuple<Sender<T>, Receiver<T>> make_channel(const channel_options& options) {
 	static_assert(std::is_copy_constructible_v<T> || std::is_move_constructible_v<T>, "type not movable or copyable.");
-	std::shared_ptr<Channel<T>> channel{new Channel<T>()};
+	std::shared_ptr<Channel<T>> channel{new Channel<T>(options)};
+	if (ChannelRegistry::instance().enabled()) {
+		std::weak_ptr<Channel<T>> weak = channel;
+		ChannelRegistry::instance().add(options.name, type_name(typeid(T)), options.fair ? "fair" : "fifo", weak,
+			[weak](channel_stats& s) {
+				std::shared_ptr<Channel<T>> ch = weak.lock();
+				if (!ch)
+					return false;
+				s = ch->stats();
+				return true;
+			});
+	}
 	Sender<T> sender{channel};
 	Receiver<T> receiver{channel};
 	return std::tuple<Sender<T>, Receiver<T>>{
@@ -220,21 +1752,22 @@ std::tuple<Sender<T>, Receiver<T>> make_channel() {
 	};
 }
 
+template <typename T>
+std::tuple<Sender<T>, Receiver<T>> make_channel() {
+	return make_channel<T>(channel_options{});
+}
+
 template <typename T>
 void Receiver<T>::iterator::next() {
 	if (!receiver)
          return;
-	while(true) {
-		if (receiver->closed()) {
-			receiver = nullptr;
-			current.reset();
-			return;
-		}
-		std::optional<T> tmp = receiver->recv();
-		if (!tmp.has_value()) continue;
-		current.emplace(std::move(tmp.value()));
+	std::optional<T> tmp = receiver->recv();
+	if (!tmp.has_value()) {
+		receiver = nullptr;
+		current.reset();
 		return;
 	}
+	current.emplace(std::move(tmp.value()));
 }
 
 
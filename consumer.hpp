@@ -0,0 +1,246 @@
+#ifndef CONSUMER_HPP
+#define CONSUMER_HPP
+
+#include "channel.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+
+enum class wait_strategy {
+    // sleep in recv until a message arrives
+    block,
+    // poll the lock-free depth without giving up the cpu
+    spin,
+    // poll the lock-free depth, yielding the cpu between empty polls
+    yield,
+    // spin for consumer_options::spin_for, then block
+    spin_then_block
+};
+
+struct consumer_options {
+    // thread name, cut to the 15 characters the kernel keeps; empty leaves it
+    std::string name;
+    // cpus the thread may run on, empty for no pinning
+    std::vector<int> cpus;
+    // run under SCHED_FIFO at this priority, 0 keeps the default policy
+    int fifo_priority = 0;
+    wait_strategy wait = wait_strategy::block;
+    std::chrono::nanoseconds spin_for{std::chrono::microseconds(50)};
+    // most messages taken per wakeup; a handler wrapped with on_batch gets
+    // them together, any other handler one by one
+    size_t batch = 1;
+};
+
+// A handler taking a whole batch as std::vector<T>&; see on_batch.
+template <typename F>
+struct batch_handler {
+    F handler;
+};
+
+template <typename F>
+batch_handler<F> on_batch(F handler) {
+    return batch_handler<F>{std::move(handler)};
+}
+
+template <typename F>
+struct is_batch_handler : std::false_type {};
+
+template <typename F>
+struct is_batch_handler<batch_handler<F>> : std::true_type {};
+
+struct consumer_stats {
+    uint64_t messages = 0;
+    uint64_t batches = 0;
+    // time spent in the handler and waiting for messages
+    uint64_t busy_ns = 0;
+    uint64_t idle_ns = 0;
+
+    double utilization() const {
+        return busy_ns + idle_ns ? double(busy_ns) / double(busy_ns + idle_ns) : 0.0;
+    }
+};
+
+// Written by the consumer thread only.
+struct consumer_metrics {
+    std::atomic<uint64_t> messages{0};
+    std::atomic<uint64_t> batches{0};
+    std::atomic<uint64_t> busy_ns{0};
+    std::atomic<uint64_t> idle_ns{0};
+
+    static void add(std::atomic<uint64_t>& counter, uint64_t n) {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+};
+
+class consumer_handle {
+    private:
+        std::thread thread;
+        std::shared_ptr<consumer_metrics> metrics;
+
+    public:
+        consumer_handle(std::thread&& thread, std::shared_ptr<consumer_metrics> metrics)
+            : thread(std::move(thread)), metrics(std::move(metrics)) {}
+        consumer_handle(consumer_handle&&) = default;
+        consumer_handle& operator=(consumer_handle&&) = default;
+        ~consumer_handle() { join(); }
+
+        bool joinable() const { return thread.joinable(); }
+        // returns once the channel is closed and drained
+        void join();
+        // zeros for a moved-from handle
+        consumer_stats stats() const;
+};
+
+inline void consumer_handle::join() {
+    if (thread.joinable())
+        thread.join();
+}
+
+inline consumer_stats consumer_handle::stats() const {
+    consumer_stats s;
+    if (!metrics)
+        return s;
+    s.messages = metrics->messages.load(std::memory_order_relaxed);
+    s.batches = metrics->batches.load(std::memory_order_relaxed);
+    s.busy_ns = metrics->busy_ns.load(std::memory_order_relaxed);
+    s.idle_ns = metrics->idle_ns.load(std::memory_order_relaxed);
+    return s;
+}
+
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+// Appends up to max messages to out using the given strategy; 0 once the
+// channel is closed and drained.
+template <typename T>
+size_t consumer_fetch(Receiver<T>& rx, std::vector<T>& out, const consumer_options& options) {
+    if (options.wait == wait_strategy::block)
+        return rx.recv_batch(out, options.batch);
+    auto spin_until = std::chrono::steady_clock::now() + options.spin_for;
+    while (true) {
+        // size() takes no lock, so an idle poll leaves the queue to producers
+        while (out.size() < options.batch && rx.size()) {
+            std::optional<T> val = rx.try_recv();
+            if (!val)
+                break;
+            out.push_back(std::move(*val));
+        }
+        if (!out.empty())
+            return out.size();
+        if (rx.closed()) {
+            // a send may have landed between the last poll and the close
+            std::optional<T> val = rx.try_recv();
+            if (!val)
+                return 0;
+            out.push_back(std::move(*val));
+            continue;
+        }
+        switch (options.wait) {
+            case wait_strategy::yield:
+                std::this_thread::yield();
+                break;
+            case wait_strategy::spin_then_block:
+                if (std::chrono::steady_clock::now() >= spin_until)
+                    return rx.recv_batch(out, options.batch);
+                cpu_relax();
+                break;
+            default:
+                cpu_relax();
+        }
+    }
+}
+
+inline void configure_consumer(std::thread& thread, const consumer_options& options) {
+    pthread_t handle = thread.native_handle();
+    if (!options.name.empty()) {
+        int err = pthread_setname_np(handle, options.name.substr(0, 15).c_str());
+        if (err)
+            throw std::system_error(err, std::generic_category(), "pthread_setname_np");
+    }
+    if (!options.cpus.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : options.cpus)
+            CPU_SET(cpu, &set);
+        int err = pthread_setaffinity_np(handle, sizeof(set), &set);
+        if (err)
+            throw std::system_error(err, std::generic_category(), "pthread_setaffinity_np");
+    }
+    if (options.fifo_priority) {
+        sched_param param{};
+        param.sched_priority = options.fifo_priority;
+        int err = pthread_setschedparam(handle, SCHED_FIFO, &param);
+        if (err)
+            throw std::system_error(err, std::generic_category(), "pthread_setschedparam");
+    }
+}
+
+// Runs handler on a new thread for every message rx receives, or for every
+// batch when it comes from on_batch, until the channel is closed and drained. The thread is named, pinned and given its
+// scheduling policy before it takes its first message; when any of that
+// fails spawn_consumer throws std::system_error and the receiver is dropped.
+template <typename T, typename F>
+consumer_handle spawn_consumer(Receiver<T> rx, F handler, const consumer_options& options = {}) {
+    if (!options.batch)
+        throw std::logic_error("Consumer batch size must be at least 1.");
+    auto metrics = std::make_shared<consumer_metrics>();
+    std::promise<bool> start;
+    std::thread thread([rx = std::move(rx), handler = std::move(handler), options, metrics,
+                        go = start.get_future()]() mutable {
+        if (!go.get())
+            return;
+        typedef std::chrono::steady_clock clock;
+        auto ns = [](clock::duration d) {
+            return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+        };
+        std::vector<T> batch;
+        batch.reserve(options.batch);
+        clock::time_point idle_since = clock::now();
+        while (consumer_fetch(rx, batch, options)) {
+            clock::time_point started = clock::now();
+            consumer_metrics::add(metrics->idle_ns, ns(started - idle_since));
+            consumer_metrics::add(metrics->messages, batch.size());
+            consumer_metrics::add(metrics->batches, 1);
+            if constexpr (is_batch_handler<F>::value) {
+                handler.handler(batch);
+            } else if constexpr (std::is_invocable_v<F&, T&&>) {
+                for (T& val : batch)
+                    handler(std::move(val));
+            } else {
+                // e.g. a generic handler taking auto&
+                for (T& val : batch)
+                    handler(val);
+            }
+            batch.clear();
+            idle_since = clock::now();
+            consumer_metrics::add(metrics->busy_ns, ns(idle_since - started));
+        }
+        consumer_metrics::add(metrics->idle_ns, ns(clock::now() - idle_since));
+    });
+    try {
+        configure_consumer(thread, options);
+    } catch (...) {
+        start.set_value(false);
+        thread.join();
+        throw;
+    }
+    start.set_value(true);
+    return consumer_handle(std::move(thread), std::move(metrics));
+}
+
+#endif
@@ -0,0 +1,358 @@
+#ifndef DEADLINE_CHANNEL_HPP
+#define DEADLINE_CHANNEL_HPP
+
+#include "registry.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+template <typename T> class DeadlineSender;
+template <typename T> class DeadlineReceiver;
+
+template <typename T>
+std::tuple<DeadlineSender<T>, DeadlineReceiver<T>> make_deadline_channel();
+
+// Earliest-deadline-first channel. Every sender owns a lane holding its
+// messages as a heap ordered by deadline; the lane publishes the deadline of
+// its head in an atomic so the consumer can pick the most urgent lane
+// without taking any lock but that lane's.
+template <typename T>
+class DeadlineChannel {
+    public:
+        typedef std::chrono::steady_clock clock;
+
+    private:
+        static constexpr clock::rep empty_lane = clock::time_point::max().time_since_epoch().count();
+
+        struct entry {
+            clock::time_point deadline;
+            uint64_t seq;
+            T value;
+
+            bool operator>(const entry& other) const {
+                return deadline != other.deadline ? deadline > other.deadline : seq > other.seq;
+            }
+        };
+
+        struct lane {
+            std::mutex mutex;
+            std::priority_queue<entry, std::vector<entry>, std::greater<entry>> run;
+            uint64_t seq = 0;
+            std::atomic<clock::rep> head{empty_lane};
+            // its sender is gone; dropped by the consumer once empty
+            std::atomic<bool> retired{false};
+        };
+
+        DeadlineChannel() {};
+
+        std::mutex lanes_mutex;
+        std::vector<std::unique_ptr<lane>> lanes;
+        // bumped when a lane is added or may be dropped
+        std::atomic<uint64_t> lanes_epoch{0};
+        // consumer-side snapshot of lanes, refreshed when lanes_epoch moves
+        std::vector<lane*> view;
+        uint64_t view_epoch = 0;
+
+        std::atomic<size_t> count{0};
+        std::atomic<bool> _closed{false};
+        std::atomic<bool> sleeping{false};
+        std::mutex wait_mutex;
+        std::condition_variable data_cond;
+
+        std::optional<T> pop_earliest();
+        lane* add_lane();
+        void retire_lane(lane* l);
+        void refresh_view();
+        void send(lane* l, T&& val, clock::time_point deadline);
+
+        friend class DeadlineSender<T>;
+        friend std::tuple<DeadlineSender<T>, DeadlineReceiver<T>> make_deadline_channel<T>();
+
+    public:
+        std::optional<T> recv();
+        std::optional<T> try_recv();
+        size_t size() const { return count.load(std::memory_order_relaxed); }
+
+        void close_channel();
+        bool closed() { return _closed; }
+
+        DeadlineChannel(const DeadlineChannel<T>&) = delete;
+        DeadlineChannel<T>& operator=(const DeadlineChannel<T>&) = delete;
+};
+
+template <typename T>
+typename DeadlineChannel<T>::lane* DeadlineChannel<T>::add_lane() {
+    std::lock_guard<std::mutex> lock(lanes_mutex);
+    lanes.emplace_back(new lane());
+    lanes_epoch.fetch_add(1, std::memory_order_release);
+    return lanes.back().get();
+}
+
+template <typename T>
+void DeadlineChannel<T>::retire_lane(lane* l) {
+    l->retired.store(true, std::memory_order_release);
+    lanes_epoch.fetch_add(1, std::memory_order_release);
+}
+
+// consumer only, so no lane it is looking at can disappear
+template <typename T>
+void DeadlineChannel<T>::refresh_view() {
+    uint64_t epoch = lanes_epoch.load(std::memory_order_acquire);
+    if (view_epoch == epoch)
+        return;
+    std::lock_guard<std::mutex> lock(lanes_mutex);
+    lanes.erase(std::remove_if(lanes.begin(), lanes.end(), [](const std::unique_ptr<lane>& l) {
+        return l->retired.load(std::memory_order_acquire) &&
+               l->head.load(std::memory_order_acquire) == empty_lane;
+    }), lanes.end());
+    view.clear();
+    for (auto& l : lanes)
+        view.push_back(l.get());
+    view_epoch = epoch;
+}
+
+template <typename T>
+void DeadlineChannel<T>::send(lane* l, T&& val, clock::time_point deadline) {
+    // max() marks an empty lane; one tick earlier still sorts after every
+    // real deadline
+    if (deadline.time_since_epoch().count() == empty_lane)
+        deadline -= clock::duration(1);
+    {
+    std::lock_guard<std::mutex> lock(l->mutex);
+    l->run.push(entry{deadline, l->seq++, std::move(val)});
+    l->head.store(l->run.top().deadline.time_since_epoch().count(), std::memory_order_release);
+    }
+    count.fetch_add(1, std::memory_order_seq_cst);
+    if (sleeping.load(std::memory_order_seq_cst)) {
+        { std::lock_guard<std::mutex> lock(wait_mutex); }
+        data_cond.notify_one();
+    }
+}
+
+template <typename T>
+std::optional<T> DeadlineChannel<T>::pop_earliest() {
+    refresh_view();
+    if (count.load(std::memory_order_acquire) == 0)
+        return std::nullopt;
+    while (true) {
+        lane* best = nullptr;
+        clock::rep best_deadline = empty_lane;
+        for (lane* l : view) {
+            clock::rep d = l->head.load(std::memory_order_acquire);
+            if (d < best_deadline) {
+                best = l;
+                best_deadline = d;
+            }
+        }
+        if (!best)
+            return std::nullopt;
+        std::unique_lock<std::mutex> lock(best->mutex);
+        if (best->run.empty())
+            continue;
+        T val = std::move(const_cast<entry&>(best->run.top()).value);
+        best->run.pop();
+        best->head.store(best->run.empty() ? empty_lane
+                         : best->run.top().deadline.time_since_epoch().count(),
+                         std::memory_order_release);
+        bool drained = best->run.empty();
+        lock.unlock();
+        count.fetch_sub(1, std::memory_order_relaxed);
+        if (drained && best->retired.load(std::memory_order_acquire))
+            lanes_epoch.fetch_add(1, std::memory_order_release);
+        return val;
+    }
+}
+
+template <typename T>
+std::optional<T> DeadlineChannel<T>::try_recv() {
+    return pop_earliest();
+}
+
+template <typename T>
+std::optional<T> DeadlineChannel<T>::recv() {
+    while (true) {
+        if (std::optional<T> val = pop_earliest())
+            return val;
+        std::unique_lock<std::mutex> lock(wait_mutex);
+        sleeping.store(true, std::memory_order_seq_cst);
+        data_cond.wait(lock, [&]{
+            return count.load(std::memory_order_seq_cst) != 0 || _closed;
+        });
+        sleeping.store(false, std::memory_order_relaxed);
+        if (count.load(std::memory_order_acquire) == 0 && _closed)
+            return std::nullopt;
+    }
+}
+
+template <typename T>
+void DeadlineChannel<T>::close_channel() {
+    {
+    std::lock_guard<std::mutex> lock(wait_mutex);
+    _closed = true;
+    }
+    data_cond.notify_all();
+}
+
+template <typename T>
+class DeadlineSender {
+    private:
+        std::shared_ptr<DeadlineChannel<T>> channel;
+        typename DeadlineChannel<T>::lane* lane;
+
+        DeadlineSender(std::shared_ptr<DeadlineChannel<T>> ch)
+            : channel(ch), lane(ch->add_lane()) {};
+
+        void moved() {
+            if (!channel)
+                throw std::logic_error("Sender has been moved.");
+        }
+
+        friend std::tuple<DeadlineSender<T>, DeadlineReceiver<T>> make_deadline_channel<T>();
+
+    public:
+        // every copy gets its own lane, dropped once the copy is destroyed
+        // and the lane drained
+        DeadlineSender(const DeadlineSender<T>& other)
+            : channel(other.channel), lane(channel ? channel->add_lane() : nullptr) {}
+        DeadlineSender<T>& operator=(const DeadlineSender<T>& other) {
+            if (this != &other)
+                *this = DeadlineSender<T>(other);
+            return *this;
+        }
+        DeadlineSender(DeadlineSender<T>&&) = default;
+        DeadlineSender<T>& operator=(DeadlineSender<T>&& other) {
+            if (this != &other) {
+                if (channel)
+                    channel->retire_lane(lane);
+                channel = std::move(other.channel);
+                lane = other.lane;
+            }
+            return *this;
+        }
+        ~DeadlineSender() {
+            if (channel)
+                channel->retire_lane(lane);
+        }
+
+        // time_point::max() may be used for messages without a deadline
+        DeadlineSender<T>& send(T&& val, std::chrono::steady_clock::time_point deadline);
+        DeadlineSender<T>& send(const T& val, std::chrono::steady_clock::time_point deadline);
+        void close();
+        bool closed();
+};
+
+template <typename T>
+DeadlineSender<T>& DeadlineSender<T>::send(T&& val, std::chrono::steady_clock::time_point deadline) {
+    moved();
+    channel->send(lane, std::move(val), deadline);
+    return *this;
+}
+
+template <typename T>
+DeadlineSender<T>& DeadlineSender<T>::send(const T& val, std::chrono::steady_clock::time_point deadline) {
+    moved();
+    channel->send(lane, T(val), deadline);
+    return *this;
+}
+
+template <typename T>
+void DeadlineSender<T>::close() {
+    moved();
+    channel->close_channel();
+}
+
+template <typename T>
+bool DeadlineSender<T>::closed() {
+    moved();
+    return channel->closed();
+}
+
+template <typename T>
+class DeadlineReceiver {
+    private:
+        std::shared_ptr<DeadlineChannel<T>> channel;
+
+        DeadlineReceiver(std::shared_ptr<DeadlineChannel<T>> ch)
+            : channel(ch) {};
+
+        void moved() {
+            if (!channel)
+                throw std::logic_error("Receiver has been moved.");
+        }
+
+        friend std::tuple<DeadlineSender<T>, DeadlineReceiver<T>> make_deadline_channel<T>();
+
+    public:
+        // earliest deadline first across all senders; ties keep each
+        // sender's send order
+        std::optional<T> recv();
+        std::optional<T> try_recv();
+        size_t size();
+        bool closed();
+
+        DeadlineReceiver(const DeadlineReceiver<T>&) = delete;
+        DeadlineReceiver<T>& operator=(const DeadlineReceiver<T>&) = delete;
+        DeadlineReceiver(DeadlineReceiver<T>&&) = default;
+        DeadlineReceiver<T>& operator=(DeadlineReceiver<T>&&) = default;
+};
+
+template <typename T>
+std::optional<T> DeadlineReceiver<T>::recv() {
+    moved();
+    return channel->recv();
+}
+
+template <typename T>
+std::optional<T> DeadlineReceiver<T>::try_recv() {
+    moved();
+    return channel->try_recv();
+}
+
+template <typename T>
+size_t DeadlineReceiver<T>::size() {
+    moved();
+    return channel->size();
+}
+
+template <typename T>
+bool DeadlineReceiver<T>::closed() {
+    moved();
+    return channel->closed();
+}
+
+template <typename T>
+std::tuple<DeadlineSender<T>, DeadlineReceiver<T>> make_deadline_channel() {
+    static_assert(std::is_move_constructible_v<T>, "type not movable.");
+    std::shared_ptr<DeadlineChannel<T>> channel{new DeadlineChannel<T>()};
+    if (ChannelRegistry::instance().enabled()) {
+        std::weak_ptr<DeadlineChannel<T>> weak = channel;
+        ChannelRegistry::instance().add("", type_name(typeid(T)), "edf", weak, [weak](channel_stats& s) {
+            std::shared_ptr<DeadlineChannel<T>> ch = weak.lock();
+            if (!ch)
+                return false;
+            s = channel_stats{};
+            s.depth = ch->size();
+            return true;
+        });
+    }
+    DeadlineSender<T> sender{channel};
+    DeadlineReceiver<T> receiver{channel};
+    return std::tuple<DeadlineSender<T>, DeadlineReceiver<T>>{
+        std::move(sender),
+        std::move(receiver)
+    };
+}
+
+#endif
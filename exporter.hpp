@@ -0,0 +1,248 @@
+#ifndef EXPORTER_HPP
+#define EXPORTER_HPP
+
+#include "registry.hpp"
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+struct exporter_options {
+    // TCP port on the loopback interface, 0 to pick a free one
+    uint16_t port = 9464;
+    // serve on this unix socket instead of TCP when set
+    std::string unix_path;
+};
+
+// Serves ChannelRegistry in the Prometheus text exposition format from a
+// background thread, one scrape at a time. Scrapes read only the channels'
+// counters and never take a queue lock.
+class PrometheusExporter {
+    private:
+        exporter_options options;
+        int listen_fd = -1;
+        int wake_pipe[2] = {-1, -1};
+        uint16_t _port = 0;
+        std::thread server;
+
+        void serve();
+        void respond(int fd);
+
+    public:
+        // binds immediately; throws std::system_error when that fails
+        explicit PrometheusExporter(exporter_options options = {});
+        ~PrometheusExporter();
+        PrometheusExporter(const PrometheusExporter&) = delete;
+        PrometheusExporter& operator=(const PrometheusExporter&) = delete;
+
+        // bound TCP port, 0 on a unix socket
+        uint16_t port() const { return _port; }
+
+        static void render(std::ostream& out, const std::vector<ChannelRegistry::snapshot>& channels);
+};
+
+namespace exporter_detail {
+
+inline void label_value(std::ostream& out, const std::string& s) {
+    for (char c : s) {
+        if (c == '\\' || c == '"')
+            out << '\\' << c;
+        else if (c == '\n')
+            out << "\\n";
+        else
+            out << c;
+    }
+}
+
+inline void labels(std::ostream& out, const ChannelRegistry::snapshot& c, const char* le = nullptr) {
+    out << "{channel=\"";
+    label_value(out, c.name);
+    out << "\",type=\"";
+    label_value(out, c.type);
+    out << "\",engine=\"" << c.engine << '"';
+    if (le)
+        out << ",le=\"" << le << '"';
+    out << '}';
+}
+
+[[noreturn]] inline void fail(const char* what) {
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+}
+
+inline void PrometheusExporter::render(std::ostream& out, const std::vector<ChannelRegistry::snapshot>& channels) {
+    using namespace exporter_detail;
+    if (channels.empty())
+        return;
+    // one family at a time, as the format requires
+    for_each_stat(channels.front().stats, [&](const char* key, uint64_t, stat_kind kind) {
+        std::string family = std::string("mpscpp_channel_") + key +
+                             (kind == stat_kind::counter ? "_total" : "");
+        out << "# TYPE " << family << (kind == stat_kind::counter ? " counter\n" : " gauge\n");
+        for (const ChannelRegistry::snapshot& c : channels)
+            for_each_stat(c.stats, [&](const char* k, uint64_t value, stat_kind) {
+                if (std::strcmp(k, key) != 0)
+                    return;
+                out << family;
+                labels(out, c);
+                out << ' ' << value << '\n';
+            });
+    });
+    for_each_rate(channels.front().stats, [&](const char* key, double) {
+        std::string family = std::string("mpscpp_channel_") + key;
+        out << "# TYPE " << family << " gauge\n";
+        for (const ChannelRegistry::snapshot& c : channels)
+            for_each_rate(c.stats, [&](const char* k, double value) {
+                if (std::strcmp(k, key) != 0)
+                    return;
+                out << family;
+                labels(out, c);
+                if (std::isinf(value))
+                    out << " +Inf\n";
+                else
+                    out << ' ' << value << '\n';
+            });
+    });
+    bool any = false;
+    for (const ChannelRegistry::snapshot& c : channels) {
+        const latency_snapshot& h = c.stats.latency;
+        if (!h.tracked)
+            continue;
+        if (!any)
+            out << "# TYPE mpscpp_channel_sojourn_seconds histogram\n";
+        any = true;
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i + 1 < latency_snapshot::buckets; ++i) {
+            cumulative += h.counts[i];
+            char le[32];
+            std::snprintf(le, sizeof(le), "%g", latency_snapshot::bound(i));
+            out << "mpscpp_channel_sojourn_seconds_bucket";
+            labels(out, c, le);
+            out << ' ' << cumulative << '\n';
+        }
+        out << "mpscpp_channel_sojourn_seconds_bucket";
+        labels(out, c, "+Inf");
+        out << ' ' << h.count << '\n';
+        out << "mpscpp_channel_sojourn_seconds_sum";
+        labels(out, c);
+        out << ' ' << double(h.sum_ns) * 1e-9 << '\n';
+        out << "mpscpp_channel_sojourn_seconds_count";
+        labels(out, c);
+        out << ' ' << h.count << '\n';
+    }
+}
+
+inline PrometheusExporter::PrometheusExporter(exporter_options opts) : options(std::move(opts)) {
+    using exporter_detail::fail;
+    if (options.unix_path.empty()) {
+        listen_fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listen_fd < 0)
+            fail("socket");
+        int on = 1;
+        ::setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(options.port);
+        if (::bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            ::close(listen_fd);
+            fail("bind");
+        }
+        socklen_t len = sizeof(addr);
+        ::getsockname(listen_fd, reinterpret_cast<sockaddr*>(&addr), &len);
+        _port = ntohs(addr.sin_port);
+    } else {
+        sockaddr_un addr{};
+        if (options.unix_path.size() >= sizeof(addr.sun_path)) {
+            errno = ENAMETOOLONG;
+            fail("bind");
+        }
+        listen_fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listen_fd < 0)
+            fail("socket");
+        addr.sun_family = AF_UNIX;
+        std::memcpy(addr.sun_path, options.unix_path.c_str(), options.unix_path.size() + 1);
+        ::unlink(options.unix_path.c_str());
+        if (::bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            ::close(listen_fd);
+            fail("bind");
+        }
+    }
+    if (::listen(listen_fd, 16) != 0 || ::pipe2(wake_pipe, O_CLOEXEC) != 0) {
+        ::close(listen_fd);
+        fail("listen");
+    }
+    server = std::thread(&PrometheusExporter::serve, this);
+}
+
+inline PrometheusExporter::~PrometheusExporter() {
+    char byte = 0;
+    ssize_t ignored = ::write(wake_pipe[1], &byte, 1);
+    (void)ignored;
+    server.join();
+    ::close(listen_fd);
+    ::close(wake_pipe[0]);
+    ::close(wake_pipe[1]);
+    if (!options.unix_path.empty())
+        ::unlink(options.unix_path.c_str());
+}
+
+inline void PrometheusExporter::serve() {
+    while (true) {
+        pollfd fds[2] = {{listen_fd, POLLIN, 0}, {wake_pipe[0], POLLIN, 0}};
+        if (::poll(fds, 2, -1) < 0)
+            continue;
+        if (fds[1].revents)
+            return;
+        int fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0)
+            continue;
+        respond(fd);
+        ::close(fd);
+    }
+}
+
+inline void PrometheusExporter::respond(int fd) {
+    // the request itself is not interpreted: every path gets the metrics
+    std::string request;
+    char buf[1024];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+        pollfd in{fd, POLLIN, 0};
+        if (::poll(&in, 1, 1000) <= 0)
+            return;
+        ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0)
+            return;
+        request.append(buf, size_t(n));
+    }
+    std::ostringstream body;
+    render(body, ChannelRegistry::instance().collect());
+    std::string payload = body.str();
+    std::string response = "HTTP/1.1 200 OK\r\n"
+                           "Content-Type: text/plain; version=0.0.4\r\n"
+                           "Content-Length: " + std::to_string(payload.size()) + "\r\n"
+                           "Connection: close\r\n\r\n" + payload;
+    for (size_t sent = 0; sent < response.size();) {
+        ssize_t n = ::send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0)
+            return;
+        sent += size_t(n);
+    }
+}
+
+#endif
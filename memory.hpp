@@ -0,0 +1,341 @@
+#ifndef MEMORY_HPP
+#define MEMORY_HPP
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+struct arena_options {
+    // back regions with MAP_HUGETLB pages, falling back to transparent huge
+    // pages and then to ordinary pages when the kernel refuses
+    bool huge_pages = false;
+    size_t region_size = size_t(2) << 20;
+};
+
+struct arena_stats {
+    size_t regions = 0;
+    size_t hugetlb_regions = 0;
+    size_t thp_regions = 0;
+    size_t bytes_mapped = 0;
+    size_t bytes_prefaulted = 0;
+    size_t bytes_locked = 0;
+    std::chrono::nanoseconds warmup_time{0};
+    size_t trims = 0;
+    size_t bytes_released = 0;
+};
+
+// Per-channel memory resource for queue nodes and payload blocks. Small blocks
+// are carved from large mapped regions so that a deep backlog stays on few
+// (huge) pages; freed blocks go to a size-class free list for reuse.
+class arena_resource : public std::pmr::memory_resource {
+    private:
+        static constexpr size_t granularity = 16;
+        static constexpr size_t max_block = 1024;
+
+        struct free_block {
+            free_block* next;
+        };
+
+        struct region {
+            char* base;
+            size_t size;
+            bool hugetlb;
+            bool thp;
+            bool locked;
+            // bytes at the end, past the bump cursor, already dropped by trim()
+            size_t tail_dropped;
+            // bytes handed out by the bump cursor, final once the cursor moves on
+            size_t carved;
+        };
+
+        arena_options options;
+        std::pmr::memory_resource* upstream;
+        std::mutex mutex;
+        std::vector<region> regions;
+        // index of the region the bump cursor points into; regions after it
+        // are spares mapped ahead of time by reserve()
+        size_t active = 0;
+        std::array<free_block*, max_block / granularity> free_lists{};
+        char* cursor = nullptr;
+        char* limit = nullptr;
+        // largest reserve() request; trim() keeps at least this much mapped
+        size_t reserved = 0;
+        arena_stats counters;
+
+        static size_t size_class(size_t bytes) {
+            return (bytes + granularity - 1) / granularity - 1;
+        }
+
+        void map_region(size_t bytes);
+        void next_region(size_t bytes);
+        static void unmap_region(const region& r);
+        void forget_region(const region& r);
+
+    protected:
+        void* do_allocate(size_t bytes, size_t alignment) override;
+        void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+            return this == &other;
+        }
+
+    public:
+        arena_resource(arena_options options = {},
+                       std::pmr::memory_resource* upstream = std::pmr::new_delete_resource())
+            : options(options), upstream(upstream) {
+            if (this->options.region_size < max_block)
+                this->options.region_size = max_block;
+        }
+        arena_resource(const arena_resource&) = delete;
+        arena_resource& operator=(const arena_resource&) = delete;
+        ~arena_resource() override;
+
+        // Maps regions covering at least `bytes` beyond the current cursor,
+        // touches every page so later allocations do not fault, and
+        // optionally mlocks them. Later trims keep `bytes` mapped and
+        // resident, and never unmap locked regions. Returns the accumulated
+        // statistics.
+        arena_stats reserve(size_t bytes, bool lock_pages = false);
+        // Returns regions whose blocks are all free to the system and drops
+        // the resident pages behind the bump cursor. Returns bytes released.
+        // Meant for idle periods: it walks every free list under the lock
+        // that allocations and deallocations take, so they wait meanwhile.
+        size_t trim();
+        arena_stats stats();
+};
+
+inline arena_resource::~arena_resource() {
+    for (const region& r : regions)
+        unmap_region(r);
+}
+
+inline void arena_resource::map_region(size_t bytes) {
+    size_t size = (bytes + options.region_size - 1) / options.region_size * options.region_size;
+    if (size == 0)
+        size = options.region_size;
+    char* base = nullptr;
+    bool hugetlb = false;
+    bool thp = false;
+#if defined(__linux__)
+    void* p = MAP_FAILED;
+    if (options.huge_pages) {
+        p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        hugetlb = p != MAP_FAILED;
+    }
+    if (p == MAP_FAILED) {
+        p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            throw std::bad_alloc();
+#if defined(MADV_HUGEPAGE)
+        thp = options.huge_pages && madvise(p, size, MADV_HUGEPAGE) == 0;
+#endif
+    }
+    base = static_cast<char*>(p);
+#else
+    base = static_cast<char*>(::operator new(size));
+#endif
+    regions.push_back(region{base, size, hugetlb, thp, false, 0, 0});
+    ++counters.regions;
+    counters.hugetlb_regions += hugetlb;
+    counters.thp_regions += thp;
+    counters.bytes_mapped += size;
+}
+
+inline void arena_resource::forget_region(const region& r) {
+    --counters.regions;
+    counters.hugetlb_regions -= r.hugetlb;
+    counters.thp_regions -= r.thp;
+    counters.bytes_mapped -= r.size;
+    counters.bytes_locked -= r.locked ? r.size : 0;
+    counters.bytes_released += r.size;
+    unmap_region(r);
+}
+
+inline void arena_resource::next_region(size_t bytes) {
+    if (cursor) {
+        regions[active].carved = size_t(cursor - regions[active].base);
+        // the cursor ran over any dropped tail, faulting it back in
+        regions[active].tail_dropped = 0;
+        ++active;
+    }
+    if (active >= regions.size())
+        map_region(bytes);
+    cursor = regions[active].base;
+    limit = cursor + regions[active].size;
+}
+
+inline void arena_resource::unmap_region(const region& r) {
+#if defined(__linux__)
+    if (r.locked)
+        munlock(r.base, r.size);
+    munmap(r.base, r.size);
+#else
+    ::operator delete(r.base);
+#endif
+}
+
+inline void* arena_resource::do_allocate(size_t bytes, size_t alignment) {
+    if (bytes == 0)
+        bytes = 1;
+    if (bytes > max_block || alignment > granularity)
+        return upstream->allocate(bytes, alignment);
+    size_t cls = size_class(bytes);
+    std::lock_guard<std::mutex> lock(mutex);
+    if (free_block* block = free_lists[cls]) {
+        free_lists[cls] = block->next;
+        return block;
+    }
+    size_t size = (cls + 1) * granularity;
+    if (size_t(limit - cursor) < size)
+        next_region(size);
+    void* p = cursor;
+    cursor += size;
+    return p;
+}
+
+inline void arena_resource::do_deallocate(void* p, size_t bytes, size_t alignment) {
+    if (bytes == 0)
+        bytes = 1;
+    if (bytes > max_block || alignment > granularity) {
+        upstream->deallocate(p, bytes, alignment);
+        return;
+    }
+    size_t cls = size_class(bytes);
+    std::lock_guard<std::mutex> lock(mutex);
+    free_block* block = static_cast<free_block*>(p);
+    block->next = free_lists[cls];
+    free_lists[cls] = block;
+}
+
+inline arena_stats arena_resource::reserve(size_t bytes, bool lock_pages) {
+    auto start = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(mutex);
+    reserved = std::max(reserved, bytes);
+    size_t first = regions.size();
+    size_t available = size_t(limit - cursor);
+    for (size_t i = cursor ? active + 1 : active; i < regions.size(); ++i)
+        available += regions[i].size;
+    if (available < bytes)
+        map_region(bytes - available);
+    if (!cursor)
+        next_region(0);
+
+    const size_t page = 4096;
+    for (size_t i = active; i < regions.size(); ++i) {
+        region& r = regions[i];
+        if (i >= first) {
+            for (size_t off = 0; off < r.size; off += page)
+                static_cast<volatile char*>(r.base)[off] = 0;
+            counters.bytes_prefaulted += r.size;
+            r.tail_dropped = 0;
+        }
+#if defined(__linux__)
+        if (lock_pages && !r.locked && mlock(r.base, r.size) == 0) {
+            r.locked = true;
+            counters.bytes_locked += r.size;
+        }
+#endif
+    }
+    counters.warmup_time += std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start);
+    return counters;
+}
+
+inline size_t arena_resource::trim() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!cursor)
+        return 0;
+    size_t released = counters.bytes_released;
+    regions[active].carved = size_t(cursor - regions[active].base);
+
+    std::vector<size_t> order(regions.size());
+    for (size_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return regions[a].base < regions[b].base;
+    });
+    auto owner = [&](const void* p) {
+        auto it = std::upper_bound(order.begin(), order.end(), static_cast<const char*>(p),
+            [&](const char* addr, size_t i) { return addr < regions[i].base; });
+        return *(it - 1);
+    };
+
+    std::vector<size_t> free_bytes(regions.size(), 0);
+    for (size_t cls = 0; cls < free_lists.size(); ++cls)
+        for (free_block* b = free_lists[cls]; b; b = b->next)
+            free_bytes[owner(b)] += (cls + 1) * granularity;
+
+    std::vector<bool> release(regions.size(), false);
+    size_t mapped = counters.bytes_mapped;
+    for (size_t i = 0; i < regions.size(); ++i) {
+        const region& r = regions[i];
+        release[i] = i != active && !r.locked && free_bytes[i] == r.carved && mapped - r.size >= reserved;
+        if (release[i])
+            mapped -= r.size;
+    }
+
+    for (size_t cls = 0; cls < free_lists.size(); ++cls) {
+        free_block** link = &free_lists[cls];
+        while (*link) {
+            if (release[owner(*link)])
+                *link = (*link)->next;
+            else
+                link = &(*link)->next;
+        }
+    }
+
+    std::vector<region> kept;
+    size_t new_active = 0;
+    for (size_t i = 0; i < regions.size(); ++i) {
+        if (release[i]) {
+            forget_region(regions[i]);
+            continue;
+        }
+        if (i == active)
+            new_active = kept.size();
+        kept.push_back(regions[i]);
+    }
+    regions.swap(kept);
+    active = new_active;
+
+#if defined(__linux__) && defined(MADV_DONTNEED)
+    const size_t page = 4096;
+    char* first_page = reinterpret_cast<char*>(
+        (reinterpret_cast<uintptr_t>(cursor) + page - 1) & ~uintptr_t(page - 1));
+    region& current = regions[active];
+    size_t tail = first_page < limit ? size_t(limit - first_page) : 0;
+    // pages the cursor has since moved onto are resident again
+    current.tail_dropped = std::min(current.tail_dropped, tail);
+    // drop the end of the tail, as far as what stays resident still covers
+    // reserve()
+    size_t resident = 0;
+    for (const region& r : regions)
+        resident += r.size - r.tail_dropped;
+    size_t excess = resident > reserved ? (resident - reserved) / page * page : 0;
+    size_t drop = std::min(tail, current.tail_dropped + excess);
+    if (drop > current.tail_dropped && !current.locked &&
+        madvise(limit - drop, drop - current.tail_dropped, MADV_DONTNEED) == 0) {
+        counters.bytes_released += drop - current.tail_dropped;
+        current.tail_dropped = drop;
+    }
+#endif
+    ++counters.trims;
+    return counters.bytes_released - released;
+}
+
+inline arena_stats arena_resource::stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return counters;
+}
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef PARALLEL_MAP_HPP
+#define PARALLEL_MAP_HPP
+
+#include "channel.hpp"
+#include "pipeline.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct reorder_stats {
+    std::atomic<uint64_t> emitted{0};
+    // results that finished while an earlier sequence number was still running
+    std::atomic<uint64_t> hol_blocked{0};
+    // times the dispatcher stalled because the reorder window was full
+    std::atomic<uint64_t> window_stalls{0};
+    std::atomic<uint64_t> window_stall_ns{0};
+    std::atomic<size_t> max_buffered{0};
+};
+
+struct parallel_map_options {
+    // maximum number of in-flight sequence numbers, 0 selects 4 * k
+    size_t window = 0;
+    std::shared_ptr<reorder_stats> stats;
+};
+
+template <typename T, typename U, typename F>
+class ordered_map_stage {
+    private:
+        struct job {
+            uint64_t seq;
+            T value;
+        };
+
+        F fn;
+        Sender<U> out;
+        size_t window;
+        std::shared_ptr<reorder_stats> stats;
+
+        threadsafe_queue<job> work;
+        std::mutex reorder_mutex;
+        std::condition_variable room_cond;
+        std::vector<std::optional<U>> slots;
+        uint64_t next_emit = 0;
+        size_t buffered = 0;
+        std::atomic<size_t> running_workers;
+
+        void complete(uint64_t seq, U&& result);
+        void finish_worker();
+
+    public:
+        ordered_map_stage(F fn, Sender<U> out, size_t workers, size_t window,
+                          std::shared_ptr<reorder_stats> stats)
+            : fn(std::move(fn)), out(std::move(out)), window(window),
+              stats(std::move(stats)), slots(window), running_workers(workers) {}
+
+        void dispatch(Receiver<T>& in);
+        void work_loop();
+};
+
+template <typename T, typename U, typename F>
+void ordered_map_stage<T, U, F>::dispatch(Receiver<T>& in) {
+    uint64_t seq = 0;
+    while (std::optional<T> val = in.recv()) {
+        {
+        std::unique_lock<std::mutex> lock(reorder_mutex);
+        if (seq - next_emit >= window) {
+            auto start = std::chrono::steady_clock::now();
+            room_cond.wait(lock, [&]{ return seq - next_emit < window; });
+            stats->window_stalls.fetch_add(1, std::memory_order_relaxed);
+            stats->window_stall_ns.fetch_add(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count(),
+                std::memory_order_relaxed);
+        }
+        }
+        work.push(job{seq++, std::move(*val)});
+    }
+    work.close();
+}
+
+template <typename T, typename U, typename F>
+void ordered_map_stage<T, U, F>::work_loop() {
+    F local = fn;
+    while (std::shared_ptr<job> j = work.wait_and_pop())
+        complete(j->seq, U(local(std::move(j->value))));
+    finish_worker();
+}
+
+template <typename T, typename U, typename F>
+void ordered_map_stage<T, U, F>::complete(uint64_t seq, U&& result) {
+    std::lock_guard<std::mutex> lock(reorder_mutex);
+    if (seq != next_emit) {
+        slots[seq % window].emplace(std::move(result));
+        ++buffered;
+        stats->hol_blocked.fetch_add(1, std::memory_order_relaxed);
+        if (buffered > stats->max_buffered.load(std::memory_order_relaxed))
+            stats->max_buffered.store(buffered, std::memory_order_relaxed);
+        return;
+    }
+    out.send(std::move(result));
+    uint64_t emitted = 1;
+    ++next_emit;
+    std::optional<U>* slot = &slots[next_emit % window];
+    while (slot->has_value()) {
+        out.send(std::move(**slot));
+        slot->reset();
+        --buffered;
+        ++emitted;
+        ++next_emit;
+        slot = &slots[next_emit % window];
+    }
+    stats->emitted.fetch_add(emitted, std::memory_order_relaxed);
+    room_cond.notify_one();
+}
+
+template <typename T, typename U, typename F>
+void ordered_map_stage<T, U, F>::finish_worker() {
+    if (running_workers.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        out.close();
+}
+
+// Results arrive on the returned receiver in input order. The handle owns
+// the k workers and the dispatcher; destroying it joins them, which waits
+// until `in` is closed and drained.
+template <typename T, typename F, typename U = std::decay_t<std::invoke_result_t<F&, T&&>>>
+std::tuple<Receiver<U>, pipeline_handle> parallel_map(Receiver<T> in, size_t k, F fn,
+                                                      parallel_map_options options = {}) {
+    if (k == 0)
+        throw std::invalid_argument("parallel_map needs at least one worker.");
+    size_t window = options.window ? options.window : 4 * k;
+    std::shared_ptr<reorder_stats> stats = options.stats ? options.stats : std::make_shared<reorder_stats>();
+
+    auto [sender, receiver] = make_channel<U>();
+    auto stage = std::make_shared<ordered_map_stage<T, U, F>>(
+        std::move(fn), std::move(sender), k, window, std::move(stats));
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < k; ++i)
+        threads.emplace_back([stage]{ stage->work_loop(); });
+    threads.emplace_back([stage, in = std::move(in)]() mutable { stage->dispatch(in); });
+
+    return std::tuple<Receiver<U>, pipeline_handle>{std::move(receiver), pipeline_handle(std::move(threads))};
+}
+
+#endif
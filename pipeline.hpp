@@ -0,0 +1,180 @@
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+#include "channel.hpp"
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// A stage type opts out of fusion with `static constexpr bool fusible = false;`,
+// which places it on its own thread between two channels.
+template <typename F, typename = void>
+struct is_fusible : std::true_type {};
+
+template <typename F>
+struct is_fusible<F, std::void_t<decltype(F::fusible)>> : std::bool_constant<F::fusible> {};
+
+template <typename F>
+struct stage_t {
+    F fn;
+};
+
+template <typename F>
+inline const stage_t<F> stage{};
+
+template <typename F>
+stage_t<F> make_stage(F fn) {
+    return stage_t<F>{std::move(fn)};
+}
+
+struct boundary_t {};
+inline constexpr boundary_t boundary{};
+
+template <typename F>
+struct sink_t {
+    F fn;
+};
+
+template <typename F>
+sink_t<F> sink(F fn) {
+    return sink_t<F>{std::move(fn)};
+}
+
+struct identity_stage {
+    template <typename X>
+    X operator()(X&& x) const { return std::forward<X>(x); }
+};
+
+template <typename F, typename G>
+struct fused_stage {
+    F first;
+    G second;
+
+    template <typename X>
+    decltype(auto) operator()(X&& x) { return second(first(std::forward<X>(x))); }
+};
+
+template <typename F, typename G>
+auto fuse(F first, G second) {
+    if constexpr (std::is_same_v<F, identity_stage>)
+        return second;
+    else
+        return fused_stage<F, G>{std::move(first), std::move(second)};
+}
+
+class pipeline_handle {
+    private:
+        std::vector<std::thread> threads;
+
+    public:
+        pipeline_handle(std::vector<std::thread>&& threads)
+            : threads(std::move(threads)) {}
+        pipeline_handle(pipeline_handle&&) = default;
+        pipeline_handle& operator=(pipeline_handle&&) = default;
+        ~pipeline_handle() { join(); }
+
+        size_t threads_running() const { return threads.size(); }
+        void join();
+};
+
+inline void pipeline_handle::join() {
+    for (std::thread& t : threads)
+        if (t.joinable())
+            t.join();
+    threads.clear();
+}
+
+template <typename T, typename Segments, typename Current>
+class pipeline {
+    private:
+        template <typename, typename, typename> friend class pipeline;
+
+        Receiver<T> source;
+        Segments segments;
+        Current current;
+
+        template <size_t I, typename In, typename Last>
+        void launch(Receiver<In> in, Last& last, std::vector<std::thread>& threads);
+
+        auto close_segment() {
+            if constexpr (std::is_same_v<Current, identity_stage>)
+                return std::move(segments);
+            else
+                return std::tuple_cat(std::move(segments), std::make_tuple(std::move(current)));
+        }
+
+    public:
+        // number of channels the running pipeline will create between threads
+        static constexpr size_t hops = std::tuple_size_v<Segments>;
+
+        pipeline(Receiver<T> source, Segments segments, Current current)
+            : source(std::move(source)), segments(std::move(segments)), current(std::move(current)) {}
+
+        template <typename F>
+        auto operator|(stage_t<F> next) &&;
+        auto operator|(boundary_t) &&;
+        template <typename F>
+        pipeline_handle operator|(sink_t<F> last) &&;
+};
+
+template <typename T>
+pipeline<T, std::tuple<>, identity_stage> source(Receiver<T> rx) {
+    return pipeline<T, std::tuple<>, identity_stage>(std::move(rx), std::tuple<>{}, identity_stage{});
+}
+
+template <typename T, typename Segments, typename Current>
+template <typename F>
+auto pipeline<T, Segments, Current>::operator|(stage_t<F> next) && {
+    if constexpr (is_fusible<F>::value) {
+        auto merged = fuse(std::move(current), std::move(next.fn));
+        return pipeline<T, Segments, decltype(merged)>(
+            std::move(source), std::move(segments), std::move(merged));
+    } else {
+        auto closed = std::tuple_cat(close_segment(), std::make_tuple(std::move(next.fn)));
+        return pipeline<T, decltype(closed), identity_stage>(
+            std::move(source), std::move(closed), identity_stage{});
+    }
+}
+
+template <typename T, typename Segments, typename Current>
+auto pipeline<T, Segments, Current>::operator|(boundary_t) && {
+    auto closed = close_segment();
+    return pipeline<T, decltype(closed), identity_stage>(
+        std::move(source), std::move(closed), identity_stage{});
+}
+
+template <typename T, typename Segments, typename Current>
+template <typename F>
+pipeline_handle pipeline<T, Segments, Current>::operator|(sink_t<F> last) && {
+    auto tail = fuse(std::move(current), std::move(last.fn));
+    std::vector<std::thread> threads;
+    threads.reserve(hops + 1);
+    launch<0, T>(std::move(source), tail, threads);
+    return pipeline_handle(std::move(threads));
+}
+
+template <typename T, typename Segments, typename Current>
+template <size_t I, typename In, typename Last>
+void pipeline<T, Segments, Current>::launch(Receiver<In> in, Last& last, std::vector<std::thread>& threads) {
+    if constexpr (I == hops) {
+        threads.emplace_back([in = std::move(in), fn = std::move(last)]() mutable {
+            for (In& val : in)
+                fn(std::move(val));
+        });
+    } else {
+        using Segment = std::tuple_element_t<I, Segments>;
+        using Out = std::decay_t<std::invoke_result_t<Segment&, In&&>>;
+        auto channel = make_channel<Out>();
+        threads.emplace_back([in = std::move(in), out = std::get<0>(channel),
+                              fn = std::move(std::get<I>(segments))]() mutable {
+            for (In& val : in)
+                out.send(fn(std::move(val)));
+            out.close();
+        });
+        launch<I + 1, Out>(std::move(std::get<1>(channel)), last, threads);
+    }
+}
+
+#endif
@@ -1,119 +1,408 @@
 #ifndef QUEUE_HPP
 #define QUEUE_HPP
+#include "stop.hpp"
+#include <atomic>
+#include <chrono>
 #include <memory>
+#include <memory_resource>
+#include <new>
 #include <condition_variable>
+#include <type_traits>
+
+enum class overflow_policy {
+    // wait for the consumer to make room
+    block,
+    // reject the value being sent
+    drop_newest,
+    // evict the oldest queued value to make room
+    drop_oldest,
+    // like drop_oldest, but reuse the evicted node and payload storage
+    overwrite
+};
 
 template<typename T>
 class threadsafe_queue
 {
     private:
+        struct node;
+        struct node_deleter
+        {
+            std::pmr::memory_resource* resource;
+            void operator()(node* n) const;
+        };
+        typedef std::unique_ptr<node, node_deleter> node_ptr;
         struct node
         {
             std::shared_ptr<T> data;
-            std::unique_ptr<node> next;
+            node_ptr next;
+        };
+        // payload storage allocated before a lock is taken and filled under it
+        struct late_value
+        {
+            union { T value; };
+            bool live = false;
+            late_value() {}
+            ~late_value() { if(live) value.~T(); }
         };
+        std::pmr::memory_resource* resource;
         std::mutex head_mutex;
-        std::unique_ptr<node> head;
+        node_ptr head;
         std::mutex tail_mutex;
         node* tail;
         std::condition_variable data_cond;
+        // consumers blocked on an empty queue wait here under head_mutex
+        std::atomic<size_t> data_waiters{0};
+        std::atomic<bool> closed{false};
+        // monotonic link and unlink counts, each written under its own
+        // lock; the difference is the depth
+        std::atomic<size_t> pushed{0};
+        std::atomic<size_t> popped{0};
+        // producers blocked on a full bounded queue wait here under tail_mutex
+        std::condition_variable space_cond;
+        std::atomic<size_t> space_waiters{0};
         
         node* get_tail() {
             std::lock_guard<std::mutex> tail_lock(tail_mutex);
             return tail;
         }
-        std::unique_ptr<node> pop_head() {
-            std::unique_ptr<node> old_head=std::move(head);
+        node_ptr pop_head() {
+            node_ptr old_head=std::move(head);
             head=std::move(old_head->next);
+            unlinked();
+            if(space_waiters.load(std::memory_order_seq_cst)!=0)
+            {
+                { std::lock_guard<std::mutex> tail_lock(tail_mutex); }
+                space_cond.notify_one();
+            }
             return old_head;
         }
-        std::unique_lock<std::mutex> wait_for_data() {
+        // pushers notify without head_mutex, so a consumer between its check
+        // and its wait would miss them; waking through head_mutex closes that
+        void notify_data() {
+            if(data_waiters.load(std::memory_order_seq_cst)!=0)
+            {
+                { std::lock_guard<std::mutex> head_lock(head_mutex); }
+                data_cond.notify_one();
+            }
+        }
+        void link_tail(std::shared_ptr<T>&& new_data, node_ptr&& ptr) {
+            tail->data = std::move(new_data);
+            node* const new_tail = ptr.get();
+            tail->next = std::move(ptr);
+            tail = new_tail;
+            pushed.store(pushed.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+        void unlinked() {
+            popped.store(popped.load(std::memory_order_relaxed) + 1, std::memory_order_seq_cst);
+        }
+        // popped first, acquiring the pushes it was made after, so the
+        // difference never goes negative
+        size_t depth(std::memory_order order) const {
+            size_t out = popped.load(order == std::memory_order_relaxed ? std::memory_order_acquire : order);
+            return pushed.load(order) - out;
+        }
+        template<typename Stop>
+        std::unique_lock<std::mutex> wait_for_data(const Stop& stop) {
             std::unique_lock<std::mutex> head_lock(head_mutex);
-            data_cond.wait(head_lock,[&]{return head.get()!=get_tail();});
+            data_waiters.fetch_add(1, std::memory_order_seq_cst);
+            data_cond.wait(head_lock,[&]{return head.get()!=get_tail() || closed || stop.stop_requested();});
+            data_waiters.fetch_sub(1, std::memory_order_relaxed);
             return std::move(head_lock);
         }
-        std::unique_ptr<node> wait_pop_head() {
-            std::unique_lock<std::mutex> head_lock(wait_for_data());
+        // declared before the head lock so it is destroyed after it
+        template<typename Stop>
+        auto wake_consumer_on(const Stop& stop) {
+            return wake_on_stop(stop, [this]{
+                { std::lock_guard<std::mutex> head_lock(head_mutex); }
+                data_cond.notify_all();
+            });
+        }
+        template<typename Stop>
+        node_ptr wait_pop_head(const Stop& stop) {
+            [[maybe_unused]] auto wake = wake_consumer_on(stop);
+            std::unique_lock<std::mutex> head_lock(wait_for_data(stop));
+            if(head.get()==get_tail())
+                return node_ptr(nullptr, node_deleter{resource});
             return pop_head();
         }
-        std::unique_ptr<node> wait_pop_head(T& value) {
-            std::unique_lock<std::mutex> head_lock(wait_for_data());
+        node_ptr wait_pop_head(T& value) {
+            std::unique_lock<std::mutex> head_lock(wait_for_data(never_stop{}));
+            if(head.get()==get_tail())
+                return node_ptr(nullptr, node_deleter{resource});
             value=std::move(*head->data);
             return pop_head();
         }
 
-        std::unique_ptr<node> try_pop_head() {
+        template<typename Clock, typename Duration, typename Stop>
+        node_ptr wait_pop_head_until(const std::chrono::time_point<Clock, Duration>& deadline, const Stop& stop) {
+            [[maybe_unused]] auto wake = wake_consumer_on(stop);
+            std::unique_lock<std::mutex> head_lock(head_mutex);
+            data_waiters.fetch_add(1, std::memory_order_seq_cst);
+            bool ready = data_cond.wait_until(head_lock,deadline,[&]{return head.get()!=get_tail() || closed || stop.stop_requested();});
+            data_waiters.fetch_sub(1, std::memory_order_relaxed);
+            if(!ready || head.get()==get_tail())
+                return node_ptr(nullptr, node_deleter{resource});
+            return pop_head();
+        }
+
+        node_ptr try_pop_head() {
 
             std::lock_guard<std::mutex> head_lock(head_mutex);
             if(head.get()==get_tail())
             {   
-                return std::unique_ptr<node>();
+                return node_ptr(nullptr, node_deleter{resource});
             }
 
             return pop_head();
         }
 
-        std::unique_ptr<node> try_pop_head(T& value) {
+        node_ptr try_pop_head(T& value) {
             std::lock_guard<std::mutex> head_lock(head_mutex);
             if(head.get()==get_tail())
             {
-                return std::unique_ptr<node>();
+                return node_ptr(nullptr, node_deleter{resource});
             }
 
             value=std::move(*head->data);
             return pop_head();
         }
 
+        node_ptr new_node() {
+            void* p = resource->allocate(sizeof(node), alignof(node));
+            return node_ptr(new (p) node{nullptr, node_ptr(nullptr, node_deleter{resource})}, node_deleter{resource});
+        }
+
     public:
-        threadsafe_queue():
-        head(new node),tail(head.get())
+        // approximate memory resource footprint of one queued element: its node
+        // plus the shared block holding the payload and reference counts
+        static constexpr size_t element_footprint = sizeof(node) + sizeof(T) + 4 * sizeof(void*);
+
+        threadsafe_queue(std::pmr::memory_resource* resource = std::pmr::new_delete_resource()):
+        resource(resource),head(new_node()),tail(head.get())
         {}
         threadsafe_queue(const threadsafe_queue& other)=delete;
         threadsafe_queue& operator=(const threadsafe_queue& other)=delete;
         void push(T new_value);
-        std::shared_ptr<T> wait_and_pop();
-        void wait_and_pop(T& value);
+        // a blocked push gives up, returning false, once stop is requested
+        // or the queue is closed
+        template<typename Evict, typename Stop = never_stop>
+        bool push_bounded(T new_value, size_t capacity, overflow_policy policy, Evict&& on_evict,
+                          const Stop& stop = Stop());
+        // links make() only if tail_mutex is free and the queue is below
+        // capacity (0 for unbounded); never waits. Node and payload storage
+        // are allocated first, so the lock only covers make() and the link.
+        template<typename Make>
+        bool try_push(Make&& make, size_t capacity = 0);
+        // as above, but under drop_oldest and overwrite a full queue evicts
+        // its oldest element instead, if head_mutex is free as well; on_evict
+        // sees it after the locks are released. No storage is recycled.
+        template<typename Make, typename Evict>
+        bool try_push(Make&& make, size_t capacity, overflow_policy policy, Evict&& on_evict);
+        // the waits return null once stop is requested
+        template<typename Stop = never_stop>
+        std::shared_ptr<T> wait_and_pop(const Stop& stop = Stop());
+        bool wait_and_pop(T& value);
+        template<typename Rep, typename Period>
+        std::shared_ptr<T> wait_and_pop_for(const std::chrono::duration<Rep, Period>& timeout);
+        template<typename Clock, typename Duration, typename Stop = never_stop>
+        std::shared_ptr<T> wait_and_pop_until(const std::chrono::time_point<Clock, Duration>& deadline,
+                                              const Stop& stop = Stop());
         std::shared_ptr<T> try_pop();
         bool try_pop(T& value);
         bool empty();
+        size_t size() const;
+        // elements ever linked and ever unlinked, popped or evicted
+        size_t pushes() const;
+        size_t pops() const;
+        void close();
 };
 
+template<typename T>
+void threadsafe_queue<T>::node_deleter::operator()(node* n) const {
+    n->~node();
+    resource->deallocate(n, sizeof(node), alignof(node));
+}
+
 template<typename T>
 void threadsafe_queue<T>::push(T new_value) {
-    std::shared_ptr<T> new_data ( std::make_shared<T>(std::move(new_value)));
-    std::unique_ptr<node> ptr(new node);
+    std::shared_ptr<T> new_data ( std::allocate_shared<T>(std::pmr::polymorphic_allocator<T>(resource), std::move(new_value)));
+    node_ptr ptr(new_node());
+    {
+    std::lock_guard<std::mutex> tail_lock(tail_mutex);
+    link_tail(std::move(new_data), std::move(ptr));
+    }
+    notify_data();
+}
+
+template<typename T>
+template<typename Evict, typename Stop>
+bool threadsafe_queue<T>::push_bounded(T new_value, size_t capacity, overflow_policy policy, Evict&& on_evict,
+                                       const Stop& stop) {
+    if (policy == overflow_policy::drop_newest && size() >= capacity)
+        return false;
+
+    std::shared_ptr<T> new_data;
+    node_ptr ptr(nullptr, node_deleter{resource});
+    auto allocate = [&]{
+        new_data = std::allocate_shared<T>(std::pmr::polymorphic_allocator<T>(resource), std::move(new_value));
+        ptr = new_node();
+    };
+    if (policy != overflow_policy::overwrite || size() < capacity)
+        allocate();
+
+    if (policy == overflow_policy::block || policy == overflow_policy::drop_newest) {
+        [[maybe_unused]] auto wake = wake_on_stop(stop, [this]{
+            { std::lock_guard<std::mutex> tail_lock(tail_mutex); }
+            space_cond.notify_all();
+        });
+        {
+        std::unique_lock<std::mutex> tail_lock(tail_mutex);
+        if (depth(std::memory_order_seq_cst) >= capacity) {
+            if (policy == overflow_policy::drop_newest)
+                return false;
+            space_waiters.fetch_add(1, std::memory_order_seq_cst);
+            space_cond.wait(tail_lock, [&]{
+                return depth(std::memory_order_seq_cst) < capacity || closed || stop.stop_requested();
+            });
+            space_waiters.fetch_sub(1, std::memory_order_relaxed);
+            if (closed || depth(std::memory_order_seq_cst) >= capacity)
+                return false;
+        }
+        link_tail(std::move(new_data), std::move(ptr));
+        }
+        notify_data();
+        return true;
+    }
+
+    // the lossy policies unlink the oldest node under both locks, but run
+    // on_evict and reuse or free its payload only after unlocking
+    auto unlink_oldest = [&]{
+        node_ptr old_head(nullptr, node_deleter{resource});
+        if (depth(std::memory_order_relaxed) >= capacity && head.get() != tail) {
+            old_head = std::move(head);
+            head = std::move(old_head->next);
+            unlinked();
+        }
+        return old_head;
+    };
+    node_ptr victim(nullptr, node_deleter{resource});
+    if (!ptr) {
+        // overwrite at capacity: recycle the oldest node and payload
+        {
+        std::lock_guard<std::mutex> head_lock(head_mutex);
+        std::lock_guard<std::mutex> tail_lock(tail_mutex);
+        victim = unlink_oldest();
+        }
+        if (victim) {
+            std::shared_ptr<T> evicted = std::move(victim->data);
+            on_evict(*evicted);
+            if constexpr (std::is_move_assignable_v<T>) {
+                if (evicted.use_count() == 1) {
+                    *evicted = std::move(new_value);
+                    new_data = std::move(evicted);
+                }
+            }
+            ptr = std::move(victim);
+        } else {
+            ptr = new_node();
+        }
+        if (!new_data)
+            new_data = std::allocate_shared<T>(std::pmr::polymorphic_allocator<T>(resource), std::move(new_value));
+    }
     {
+    std::lock_guard<std::mutex> head_lock(head_mutex);
     std::lock_guard<std::mutex> tail_lock(tail_mutex);
-    tail->data = new_data;
-    node* const new_tail = ptr.get();
-    tail->next = std::move(ptr);
-    tail = new_tail;
+    // someone may have filled the slot again meanwhile
+    victim = unlink_oldest();
+    link_tail(std::move(new_data), std::move(ptr));
+    }
+    notify_data();
+    if (victim)
+        on_evict(*victim->data);
+    return true;
+}
+
+template<typename T>
+template<typename Make>
+bool threadsafe_queue<T>::try_push(Make&& make, size_t capacity) {
+    return try_push(std::forward<Make>(make), capacity, overflow_policy::block, [](const T&){});
+}
+
+template<typename T>
+template<typename Make, typename Evict>
+bool threadsafe_queue<T>::try_push(Make&& make, size_t capacity, overflow_policy policy, Evict&& on_evict) {
+    node_ptr ptr(new_node());
+    std::shared_ptr<late_value> storage(
+        std::allocate_shared<late_value>(std::pmr::polymorphic_allocator<late_value>(resource)));
+    node_ptr victim(nullptr, node_deleter{resource});
+    {
+    std::unique_lock<std::mutex> tail_lock(tail_mutex, std::try_to_lock);
+    if (!tail_lock.owns_lock())
+        return false;
+    std::unique_lock<std::mutex> head_lock;
+    if (capacity && depth(std::memory_order_seq_cst) >= capacity) {
+        if (policy != overflow_policy::drop_oldest && policy != overflow_policy::overwrite)
+            return false;
+        // taken out of the usual head-then-tail order, so only tried
+        head_lock = std::unique_lock<std::mutex>(head_mutex, std::try_to_lock);
+        if (!head_lock.owns_lock() || head.get() == tail)
+            return false;
     }
-    data_cond.notify_one();
+    new (&storage->value) T(make());
+    storage->live = true;
+    std::shared_ptr<T> new_data(storage, &storage->value);
+    if (head_lock.owns_lock()) {
+        victim = std::move(head);
+        head = std::move(victim->next);
+        unlinked();
+        head_lock.unlock();
+    }
+    link_tail(std::move(new_data), std::move(ptr));
+    }
+    notify_data();
+    if (victim)
+        on_evict(*victim->data);
+    return true;
 }
 
-template<typename T>      
-std::shared_ptr<T> threadsafe_queue<T>::wait_and_pop() {
+template<typename T>
+template<typename Stop>
+std::shared_ptr<T> threadsafe_queue<T>::wait_and_pop(const Stop& stop) {
  
-    std::unique_ptr<node> const old_head=wait_pop_head();
-    return old_head->data;       
+    node_ptr const old_head=wait_pop_head(stop);
+    return old_head?std::move(old_head->data):std::shared_ptr<T>();
+}
+
+template<typename T>
+bool threadsafe_queue<T>::wait_and_pop(T& value) {
+    node_ptr const old_head = wait_pop_head(value);
+    return (old_head == nullptr)? false: true;
+}
+
+template<typename T>
+template<typename Rep, typename Period>
+std::shared_ptr<T> threadsafe_queue<T>::wait_and_pop_for(const std::chrono::duration<Rep, Period>& timeout) {
+    return wait_and_pop_until(std::chrono::steady_clock::now() + timeout);
 }
 
 template<typename T>
-void threadsafe_queue<T>::wait_and_pop(T& value) {
-    std::unique_ptr<node> const old_head = wait_pop_head(value);
+template<typename Clock, typename Duration, typename Stop>
+std::shared_ptr<T> threadsafe_queue<T>::wait_and_pop_until(const std::chrono::time_point<Clock, Duration>& deadline,
+                                                           const Stop& stop) {
+    node_ptr const old_head=wait_pop_head_until(deadline, stop);
+    return old_head?std::move(old_head->data):std::shared_ptr<T>();
 }
 
 template<typename T>
 std::shared_ptr<T> threadsafe_queue<T>::try_pop() {
-    std::unique_ptr<node> old_head=try_pop_head();
-    return old_head?old_head->data:std::shared_ptr<T>();
+    node_ptr old_head=try_pop_head();
+    return old_head?std::move(old_head->data):std::shared_ptr<T>();
 }
 
 template<typename T>
 bool threadsafe_queue<T>::try_pop(T& value)
 {
-    std::unique_ptr<node> const old_head=try_pop_head(value);
+    node_ptr const old_head=try_pop_head(value);
     return (old_head == nullptr)? false: true;
 }
 
@@ -123,4 +412,30 @@ bool threadsafe_queue<T>::empty() {
     return (head.get()==get_tail());
 }
 
+template<typename T>
+size_t threadsafe_queue<T>::size() const {
+    return depth(std::memory_order_relaxed);
+}
+
+template<typename T>
+size_t threadsafe_queue<T>::pushes() const {
+    return pushed.load(std::memory_order_relaxed);
+}
+
+template<typename T>
+size_t threadsafe_queue<T>::pops() const {
+    return popped.load(std::memory_order_seq_cst);
+}
+
+template<typename T>
+void threadsafe_queue<T>::close() {
+    {
+    std::lock_guard<std::mutex> head_lock(head_mutex);
+    closed = true;
+    }
+    data_cond.notify_all();
+    { std::lock_guard<std::mutex> tail_lock(tail_mutex); }
+    space_cond.notify_all();
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,125 @@
+#ifndef RECLAIMER_HPP
+#define RECLAIMER_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+// Process-wide background thread that destroys batches of objects handed to
+// it, moving destructor and deallocation cost off the threads that retire
+// them. Started on first use.
+class Reclaimer {
+    private:
+        struct garbage {
+            virtual ~garbage() = default;
+        };
+        template <typename G>
+        struct holder : garbage {
+            G items;
+            explicit holder(G&& items) : items(std::move(items)) {}
+        };
+
+        std::mutex mutex;
+        std::condition_variable work_cond;
+        std::condition_variable idle_cond;
+        std::deque<std::unique_ptr<garbage>> pending;
+        uint64_t retired = 0;
+        uint64_t reclaimed = 0;
+        bool stopping = false;
+        std::thread worker;
+
+        Reclaimer() = default;
+        ~Reclaimer();
+        void run();
+        void reclaim(std::unique_lock<std::mutex>& lock);
+
+    public:
+        Reclaimer(const Reclaimer&) = delete;
+        Reclaimer& operator=(const Reclaimer&) = delete;
+
+        static Reclaimer& instance();
+
+        // takes ownership of items and destroys them on the reclaimer thread
+        template <typename G>
+        void retire(G&& items);
+        // waits until every batch retired so far has been destroyed; on the
+        // reclaimer thread itself, where a batch may hold the last handle to
+        // another channel, destroys the pending batches inline instead
+        void drain();
+        uint64_t batches_reclaimed();
+};
+
+inline Reclaimer& Reclaimer::instance() {
+    static Reclaimer reclaimer;
+    return reclaimer;
+}
+
+inline Reclaimer::~Reclaimer() {
+    {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+    }
+    work_cond.notify_one();
+    if (worker.joinable())
+        worker.join();
+}
+
+template <typename G>
+void Reclaimer::retire(G&& items) {
+    std::unique_ptr<garbage> batch(new holder<std::decay_t<G>>(std::forward<G>(items)));
+    {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!worker.joinable())
+        worker = std::thread(&Reclaimer::run, this);
+    pending.push_back(std::move(batch));
+    ++retired;
+    }
+    work_cond.notify_one();
+}
+
+inline void Reclaimer::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        work_cond.wait(lock, [&]{ return !pending.empty() || stopping; });
+        if (pending.empty())
+            return;
+        reclaim(lock);
+    }
+}
+
+// Batches are taken one at a time so that a destructor calling drain() can
+// finish the rest before its own memory goes away.
+inline void Reclaimer::reclaim(std::unique_lock<std::mutex>& lock) {
+    while (!pending.empty()) {
+        std::unique_ptr<garbage> batch = std::move(pending.front());
+        pending.pop_front();
+        lock.unlock();
+        batch.reset();
+        lock.lock();
+        ++reclaimed;
+        idle_cond.notify_all();
+    }
+}
+
+inline void Reclaimer::drain() {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!worker.joinable())
+        return;
+    if (std::this_thread::get_id() == worker.get_id()) {
+        reclaim(lock);
+        return;
+    }
+    uint64_t target = retired;
+    idle_cond.wait(lock, [&]{ return reclaimed >= target; });
+}
+
+inline uint64_t Reclaimer::batches_reclaimed() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return reclaimed;
+}
+
+#endif
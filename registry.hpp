@@ -0,0 +1,203 @@
+#ifndef REGISTRY_HPP
+#define REGISTRY_HPP
+
+#include "stats.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <typeinfo>
+#include <vector>
+#if __has_include(<cxxabi.h>)
+#include <cxxabi.h>
+#endif
+
+enum class dump_format { text, json };
+
+inline std::string type_name(const std::type_info& info) {
+#if __has_include(<cxxabi.h>)
+    int status = 0;
+    std::unique_ptr<char, void (*)(void*)> name(
+        abi::__cxa_demangle(info.name(), nullptr, nullptr, &status), std::free);
+    if (status == 0 && name)
+        return name.get();
+#endif
+    return info.name();
+}
+
+// Opt-in, process-wide index of live channels. Once enabled, every channel
+// made afterwards registers itself; its entry disappears with the channel.
+// Dumps only read the channels' counters, never their queue locks.
+// Periodic and signal-triggered dumps to a file live in registry_dump.hpp.
+class ChannelRegistry {
+    public:
+        struct snapshot {
+            uint64_t id;
+            std::string name;
+            std::string type;
+            std::string engine;
+            channel_stats stats;
+        };
+
+    private:
+        struct entry {
+            uint64_t id;
+            std::string name;
+            std::string type;
+            std::string engine;
+            // expires with the channel
+            std::weak_ptr<const void> owner;
+            // fills in the stats, false once the channel is gone
+            std::function<bool(channel_stats&)> probe;
+        };
+
+        std::atomic<bool> _enabled{false};
+        std::atomic<uint64_t> next_id{0};
+        std::mutex mutex;
+        std::vector<entry> entries;
+        // add() drops expired entries once there are this many, so channels
+        // that come and go without a collect() do not pile up
+        size_t prune_at = 16;
+
+        ChannelRegistry() = default;
+
+    public:
+        ChannelRegistry(const ChannelRegistry&) = delete;
+        ChannelRegistry& operator=(const ChannelRegistry&) = delete;
+
+        static ChannelRegistry& instance();
+
+        void enable(bool on = true) { _enabled.store(on, std::memory_order_release); }
+        bool enabled() const { return _enabled.load(std::memory_order_acquire); }
+
+        // an empty name becomes "channel-<id>"; returns the id. The entry
+        // lasts as long as owner does.
+        uint64_t add(std::string name, std::string type, std::string engine, std::weak_ptr<const void> owner,
+                     std::function<bool(channel_stats&)> probe);
+        // live channels with their current stats, dropping entries of
+        // destroyed channels
+        std::vector<snapshot> collect();
+
+        void dump(std::ostream& out, dump_format format = dump_format::text);
+        // writes through a temporary file renamed into place
+        bool dump_to(const std::string& path, dump_format format = dump_format::text);
+};
+
+inline ChannelRegistry& ChannelRegistry::instance() {
+    static ChannelRegistry registry;
+    return registry;
+}
+
+inline uint64_t ChannelRegistry::add(std::string name, std::string type, std::string engine,
+                                     std::weak_ptr<const void> owner, std::function<bool(channel_stats&)> probe) {
+    uint64_t id = next_id.fetch_add(1, std::memory_order_relaxed);
+    if (name.empty())
+        name = "channel-" + std::to_string(id);
+    std::lock_guard<std::mutex> lock(mutex);
+    if (entries.size() >= prune_at) {
+        entries.erase(std::remove_if(entries.begin(), entries.end(),
+                                     [](const entry& e) { return e.owner.expired(); }),
+                      entries.end());
+        prune_at = std::max<size_t>(16, 2 * entries.size());
+    }
+    entries.push_back(entry{id, std::move(name), std::move(type), std::move(engine), std::move(owner),
+                            std::move(probe)});
+    return id;
+}
+
+inline std::vector<ChannelRegistry::snapshot> ChannelRegistry::collect() {
+    std::vector<snapshot> out;
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t live = 0;
+    for (entry& e : entries) {
+        channel_stats s;
+        if (!e.probe(s))
+            continue;
+        out.push_back(snapshot{e.id, e.name, e.type, e.engine, s});
+        if (&entries[live] != &e)
+            entries[live] = std::move(e);
+        ++live;
+    }
+    entries.resize(live);
+    return out;
+}
+
+namespace registry_detail {
+
+inline void json_string(std::ostream& out, const std::string& s) {
+    out << '"';
+    for (char c : s) {
+        if (c == '"' || c == '\\')
+            out << '\\' << c;
+        else if (static_cast<unsigned char>(c) < 0x20) {
+            char buf[8];
+            std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out << buf;
+        } else
+            out << c;
+    }
+    out << '"';
+}
+
+}
+
+inline void ChannelRegistry::dump(std::ostream& out, dump_format format) {
+    std::vector<snapshot> channels = collect();
+    if (format == dump_format::text) {
+        for (const snapshot& c : channels) {
+            out << c.name << " type=" << c.type << " engine=" << c.engine;
+            for_each_stat(c.stats, [&](const char* key, uint64_t value, stat_kind) {
+                out << ' ' << key << '=' << value;
+            });
+            for_each_rate(c.stats, [&](const char* key, double value) {
+                out << ' ' << key << '=' << value;
+            });
+            out << '\n';
+        }
+        return;
+    }
+    out << "{\"channels\":[";
+    for (size_t i = 0; i < channels.size(); ++i) {
+        const snapshot& c = channels[i];
+        out << (i ? ",{" : "{") << "\"id\":" << c.id << ",\"name\":";
+        registry_detail::json_string(out, c.name);
+        out << ",\"type\":";
+        registry_detail::json_string(out, c.type);
+        out << ",\"engine\":";
+        registry_detail::json_string(out, c.engine);
+        for_each_stat(c.stats, [&](const char* key, uint64_t value, stat_kind) {
+            out << ",\"" << key << "\":" << value;
+        });
+        for_each_rate(c.stats, [&](const char* key, double value) {
+            out << ",\"" << key << "\":";
+            if (std::isfinite(value))
+                out << value;
+            else
+                out << "null";
+        });
+        out << '}';
+    }
+    out << "]}\n";
+}
+
+inline bool ChannelRegistry::dump_to(const std::string& path, dump_format format) {
+    std::string tmp = path + ".tmp";
+    {
+    std::ofstream file(tmp, std::ios::trunc);
+    if (!file)
+        return false;
+    dump(file, format);
+    if (!file.flush())
+        return false;
+    }
+    return std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef REGISTRY_DUMP_HPP
+#define REGISTRY_DUMP_HPP
+
+#include "registry.hpp"
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+// Background writer of ChannelRegistry dumps, periodic and on a signal.
+// POSIX only, which is why it is kept apart from the registry itself.
+class RegistryDumper {
+    private:
+        // the signal handler only writes a byte to wake_pipe
+        std::mutex mutex;
+        std::thread writer;
+        int wake_pipe[2] = {-1, -1};
+        int signum = 0;
+        struct sigaction previous{};
+        std::atomic<bool> stopping{false};
+        inline static std::atomic<int> signal_fd{-1};
+
+        // the registry is built first so it outlives the writer
+        RegistryDumper() { ChannelRegistry::instance(); }
+        ~RegistryDumper() { stop_dumping(); }
+
+        static void on_signal(int);
+        void write_loop(std::string path, dump_format format, std::chrono::milliseconds period);
+
+    public:
+        RegistryDumper(const RegistryDumper&) = delete;
+        RegistryDumper& operator=(const RegistryDumper&) = delete;
+
+        static RegistryDumper& instance();
+
+        // Starts a thread rewriting path every period (0 for never) and
+        // whenever signal signum (0 for none) is delivered; replaces any
+        // earlier configuration.
+        void dump_to_file(std::string path, dump_format format, std::chrono::milliseconds period,
+                          int signum = 0);
+        void stop_dumping();
+};
+
+inline RegistryDumper& RegistryDumper::instance() {
+    static RegistryDumper dumper;
+    return dumper;
+}
+
+inline void RegistryDumper::on_signal(int) {
+    int saved = errno;
+    int fd = signal_fd.load(std::memory_order_relaxed);
+    if (fd >= 0) {
+        char byte = 0;
+        ssize_t ignored = ::write(fd, &byte, 1);
+        (void)ignored;
+    }
+    errno = saved;
+}
+
+inline void RegistryDumper::write_loop(std::string path, dump_format format, std::chrono::milliseconds period) {
+    while (true) {
+        pollfd wake{wake_pipe[0], POLLIN, 0};
+        int ready = poll(&wake, 1, period.count() ? int(period.count()) : -1);
+        if (stopping.load(std::memory_order_acquire))
+            return;
+        if (ready < 0)
+            continue;
+        if (ready > 0) {
+            char buf[64];
+            while (::read(wake_pipe[0], buf, sizeof(buf)) > 0) {}
+        }
+        ChannelRegistry::instance().dump_to(path, format);
+    }
+}
+
+inline void RegistryDumper::dump_to_file(std::string path, dump_format format,
+                                         std::chrono::milliseconds period, int signum) {
+    stop_dumping();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (::pipe(wake_pipe) != 0)
+        throw std::system_error(errno, std::generic_category(), "pipe");
+    for (int fd : wake_pipe) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    stopping.store(false, std::memory_order_relaxed);
+    if (signum) {
+        signal_fd.store(wake_pipe[1], std::memory_order_relaxed);
+        struct sigaction action{};
+        action.sa_handler = &RegistryDumper::on_signal;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(signum, &action, &previous);
+        this->signum = signum;
+    }
+    writer = std::thread(&RegistryDumper::write_loop, this, std::move(path), format, period);
+}
+
+inline void RegistryDumper::stop_dumping() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!writer.joinable())
+        return;
+    if (signum) {
+        sigaction(signum, &previous, nullptr);
+        signal_fd.store(-1, std::memory_order_relaxed);
+        signum = 0;
+    }
+    stopping.store(true, std::memory_order_release);
+    char byte = 0;
+    ssize_t ignored = ::write(wake_pipe[1], &byte, 1);
+    (void)ignored;
+    writer.join();
+    ::close(wake_pipe[0]);
+    ::close(wake_pipe[1]);
+    wake_pipe[0] = wake_pipe[1] = -1;
+}
+
+#endif
@@ -0,0 +1,134 @@
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if __has_include(<bit>)
+#include <bit>
+#endif
+
+// Queue sojourn times in power-of-two microsecond buckets: bucket i counts
+// messages that waited at most 2^i us, the last one everything longer.
+struct latency_snapshot {
+    static constexpr size_t buckets = 24;
+    bool tracked = false;
+    uint64_t counts[buckets] = {};
+    uint64_t count = 0;
+    uint64_t sum_ns = 0;
+
+    // upper bound of bucket i in seconds
+    static double bound(size_t i) { return double(uint64_t(1) << i) * 1e-6; }
+};
+
+// Written by the consumer alone, read by anyone; kept on its own cache
+// lines so scrapes and producers do not contend with it.
+struct alignas(64) latency_histogram {
+    std::atomic<uint64_t> counts[latency_snapshot::buckets] = {};
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> sum_ns{0};
+
+    void record(std::chrono::nanoseconds sojourn) {
+        uint64_t ns = sojourn.count() > 0 ? uint64_t(sojourn.count()) : 0;
+        uint64_t us = (ns + 999) / 1000;
+        size_t i = us <= 1 ? 0 : bit_width(us - 1);
+        if (i >= latency_snapshot::buckets)
+            i = latency_snapshot::buckets - 1;
+        counts[i].store(counts[i].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        sum_ns.store(sum_ns.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+        count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    static size_t bit_width(uint64_t v) {
+#if defined(__cpp_lib_bitops)
+        return size_t(std::bit_width(v));
+#else
+        size_t n = 0;
+        for (; v; v >>= 1)
+            ++n;
+        return n;
+#endif
+    }
+
+    latency_snapshot snapshot() const {
+        latency_snapshot s;
+        s.tracked = true;
+        for (size_t i = 0; i < latency_snapshot::buckets; ++i)
+            s.counts[i] = counts[i].load(std::memory_order_relaxed);
+        s.count = count.load(std::memory_order_relaxed);
+        s.sum_ns = sum_ns.load(std::memory_order_relaxed);
+        return s;
+    }
+};
+
+struct producer_stats {
+    uint64_t id = 0;
+    uint64_t messages = 0;
+    uint64_t bytes = 0;
+    // waiting for credits, byte budget or queue capacity
+    std::chrono::nanoseconds blocked{0};
+    // total time inside send calls, blocked time included
+    std::chrono::nanoseconds sending{0};
+};
+
+struct channel_stats {
+    size_t depth = 0;
+    uint64_t received = 0;
+    uint64_t dropped = 0;
+    // byte figures are only maintained when byte tracking is enabled
+    size_t bytes_in_flight = 0;
+    size_t peak_bytes = 0;
+    size_t max_bytes = 0;
+    size_t capacity = 0;
+    uint64_t aqm_dropped = 0;
+    uint64_t aqm_marked = 0;
+    uint64_t expired = 0;
+    bool congested = false;
+    uint64_t high_crossings = 0;
+    // sends refused once shutdown began, and blocked sends given up because
+    // the channel was closed, by close() or shutdown
+    uint64_t rejected = 0;
+    // only tracked when channel_options::latency_histogram is set
+    latency_snapshot latency;
+    // one entry per Sender when channel_options::producer_accounting is set
+    std::vector<producer_stats> producers;
+    // moving averages in messages per second, and the backlog's expected
+    // drain time in seconds, infinite while it is not shrinking or the
+    // consumer has stalled; zero unless channel_options::rate_window is set
+    double arrival_rate = 0;
+    double service_rate = 0;
+    double time_to_drain = 0;
+};
+
+enum class stat_kind { gauge, counter };
+
+// Calls f(name, value, kind) for every scalar field, in declaration order.
+template <typename F>
+void for_each_stat(const channel_stats& s, F&& f) {
+    f("depth", uint64_t(s.depth), stat_kind::gauge);
+    f("received", s.received, stat_kind::counter);
+    f("dropped", s.dropped, stat_kind::counter);
+    f("bytes_in_flight", uint64_t(s.bytes_in_flight), stat_kind::gauge);
+    f("peak_bytes", uint64_t(s.peak_bytes), stat_kind::gauge);
+    f("max_bytes", uint64_t(s.max_bytes), stat_kind::gauge);
+    f("capacity", uint64_t(s.capacity), stat_kind::gauge);
+    f("aqm_dropped", s.aqm_dropped, stat_kind::counter);
+    f("aqm_marked", s.aqm_marked, stat_kind::counter);
+    f("expired", s.expired, stat_kind::counter);
+    f("congested", uint64_t(s.congested), stat_kind::gauge);
+    f("high_crossings", s.high_crossings, stat_kind::counter);
+    f("rejected", s.rejected, stat_kind::counter);
+}
+
+// Calls f(name, value) for every rate estimate.
+template <typename F>
+void for_each_rate(const channel_stats& s, F&& f) {
+    f("arrival_rate", s.arrival_rate);
+    f("service_rate", s.service_rate);
+    f("time_to_drain_seconds", s.time_to_drain);
+}
+
+#endif
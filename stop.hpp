@@ -0,0 +1,45 @@
+#ifndef STOP_HPP
+#define STOP_HPP
+
+#include <atomic>
+#include <type_traits>
+#include <utility>
+#if __has_include(<stop_token>)
+#include <stop_token>
+#endif
+
+// Stop token for waits that cannot be cancelled; blocking paths take either
+// this or a std::stop_token.
+struct never_stop {
+    bool stop_requested() const { return false; }
+};
+
+template <typename F>
+int wake_on_stop(const never_stop&, F&&) {
+    return 0;
+}
+
+#ifdef __cpp_lib_jthread
+// Calls wake once stop is requested, for as long as the result is alive.
+// wake must only take locks the waiter does not hold while destroying it.
+template <typename F>
+std::stop_callback<std::decay_t<F>> wake_on_stop(const std::stop_token& stop, F&& wake) {
+    return std::stop_callback<std::decay_t<F>>(stop, std::forward<F>(wake));
+}
+#endif
+
+// Requested once either stop is or flag is set. Whoever sets flag must wake
+// the waiters itself; wake_on_stop only covers stop.
+template <typename Stop>
+struct stop_or_flag {
+    const Stop& stop;
+    const std::atomic<bool>& flag;
+    bool stop_requested() const { return flag.load(std::memory_order_seq_cst) || stop.stop_requested(); }
+};
+
+template <typename Stop, typename F>
+auto wake_on_stop(const stop_or_flag<Stop>& both, F&& wake) {
+    return wake_on_stop(both.stop, std::forward<F>(wake));
+}
+
+#endif
@@ -0,0 +1,68 @@
+// One Sender shared by several threads: credit waiters must all be woken as
+// credits come back, and every flushing thread once the queue drains.
+//
+//   g++ -std=c++17 -O2 -pthread -I.. shared_sender.cpp -o shared_sender
+
+#include "../channel.hpp"
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+static const int threads = 4;
+static const int per_thread = 20000;
+
+static void credit_window_of_one() {
+    channel_options options;
+    options.credits = 1;
+    auto [tx, rx] = make_channel<int>(options);
+    std::vector<std::thread> producers;
+    for (int t = 0; t < threads; ++t)
+        producers.emplace_back([&tx] {
+            for (int i = 0; i < per_thread; ++i)
+                tx.send(i);
+        });
+    for (int i = 0; i < threads * per_thread; ++i) {
+        assert(rx.recv());
+        assert(rx.size() <= 1);
+    }
+    for (std::thread& p : producers)
+        p.join();
+    assert(tx.credits() == 1);
+}
+
+// each flusher waits for a later watermark than the one before, so the
+// first to return must not stop the others from being woken
+static void concurrent_flushes() {
+    auto [tx, rx] = make_channel<int>();
+    std::vector<std::thread> flushers;
+    std::atomic<int> flushed{0};
+    auto started = std::chrono::steady_clock::now();
+    for (int t = 0; t < threads; ++t) {
+        for (int i = 0; i < per_thread; ++i)
+            tx.send(i);
+        flushers.emplace_back([&tx, &flushed] {
+            if (tx.flush_for(std::chrono::seconds(10)))
+                ++flushed;
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    for (int i = 0; i < threads * per_thread; ++i) {
+        assert(rx.recv());
+        if (i % 1000 == 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    for (std::thread& f : flushers)
+        f.join();
+    assert(flushed == threads);
+    assert(std::chrono::steady_clock::now() - started < std::chrono::seconds(5));
+}
+
+int main() {
+    credit_window_of_one();
+    concurrent_flushes();
+    std::puts("ok");
+}
@@ -0,0 +1,109 @@
+#ifndef TRACING_HPP
+#define TRACING_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+// One hop of a sampled message: how long it sat in the channel and how long
+// the receiving thread worked on it before asking for its next message.
+struct trace_span {
+    uint64_t trace_id = 0;
+    uint32_t hop = 0;
+    std::string channel;
+    std::chrono::steady_clock::time_point enqueued;
+    std::chrono::steady_clock::time_point dequeued;
+    std::chrono::steady_clock::time_point finished;
+
+    std::chrono::nanoseconds queueing() const { return dequeued - enqueued; }
+    std::chrono::nanoseconds processing() const { return finished - dequeued; }
+};
+
+// Travels with a sampled message; unsampled messages carry none.
+struct trace_context {
+    uint64_t trace_id = 0;
+    uint32_t hop = 0;
+    std::chrono::steady_clock::time_point enqueued;
+    std::chrono::steady_clock::time_point dequeued;
+    std::string channel;
+};
+
+namespace tracing {
+
+// The context of the sampled message this thread received last, if it is
+// still working on it; sends from this thread continue its trace.
+inline thread_local std::unique_ptr<trace_context> current;
+
+// Set once a sampling channel exists; until then no thread can hold a
+// context, and the hooks below return without touching current.
+inline std::atomic<bool> enabled{false};
+
+inline std::mutex sink_mutex;
+inline std::function<void(const trace_span&)> sink;
+
+inline uint64_t new_trace_id() {
+    static std::atomic<uint64_t> next{uint64_t(std::chrono::steady_clock::now().time_since_epoch().count())};
+    // splitmix64 over a counter: distinct and well spread
+    uint64_t z = next.fetch_add(0x9e3779b97f4a7c15, std::memory_order_relaxed);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+// context for a message about to be sent: the current trace's next hop, a
+// fresh trace when sample says so, or nothing
+inline std::unique_ptr<trace_context> attach(bool sample) {
+    if (!enabled.load(std::memory_order_relaxed) || (!current && !sample))
+        return nullptr;
+    std::unique_ptr<trace_context> ctx(new trace_context());
+    ctx->trace_id = current ? current->trace_id : new_trace_id();
+    ctx->hop = current ? current->hop + 1 : 0;
+    ctx->enqueued = std::chrono::steady_clock::now();
+    return ctx;
+}
+
+// Ends this thread's current hop and reports it to the sink.
+inline void finish() {
+    if (!enabled.load(std::memory_order_relaxed) || !current)
+        return;
+    std::unique_ptr<trace_context> ctx = std::move(current);
+    trace_span span{ctx->trace_id, ctx->hop, std::move(ctx->channel), ctx->enqueued, ctx->dequeued,
+                    std::chrono::steady_clock::now()};
+    std::lock_guard<std::mutex> lock(sink_mutex);
+    if (sink)
+        sink(span);
+}
+
+// Called by a receiving thread for every delivered message; a hop still open
+// here, from the previous message of a batch, ends now.
+inline void received(std::unique_ptr<trace_context>&& ctx, const std::string& channel) {
+    if (!enabled.load(std::memory_order_relaxed))
+        return;
+    finish();
+    if (!ctx)
+        return;
+    ctx->dequeued = std::chrono::steady_clock::now();
+    ctx->channel = channel;
+    current = std::move(ctx);
+}
+
+}
+
+// Spans are reported from the receiving threads as each hop finishes.
+inline void set_trace_sink(std::function<void(const trace_span&)> sink) {
+    std::lock_guard<std::mutex> lock(tracing::sink_mutex);
+    tracing::sink = std::move(sink);
+}
+
+// Ends the calling thread's current hop early, e.g. in the last stage of a
+// pipeline once a sampled message is fully handled.
+inline void finish_trace() {
+    tracing::finish();
+}
+
+#endif